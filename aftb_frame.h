@@ -0,0 +1,167 @@
+#ifndef _AFTB_FRAME_H_
+#define _AFTB_FRAME_H_
+
+/*
+ * Binary frame transport for Afterburner GAL project.
+ *
+ *  Frames carry packed fuse-map bytes instead of hex encoded text lines.
+ *  Frame layout (multi-byte values are little endian):
+ *    [len] [seq] [addr lo] [addr hi] [payload: len bytes] [crc lo] [crc hi]
+ *  - len : payload size 0 - FRAME_MAX_PAYLOAD. Frame with len 0 ends the transfer.
+ *  - seq : frame sequence number, wraps around after 255
+ *  - addr: fuse index of the first payload bit, bits are stored LSB first
+ *  - crc : CRC16-CCITT (poly 0x1021, init 0xFFFF) of all preceding frame bytes
+ *
+ *  A valid frame is acknowledged by [FRAME_ACK] [seq] once it is processed.
+ *  A corrupted frame is rejected by [FRAME_NAK] [expected seq], then the input
+ *  is discarded until the line is quiet and the sender rewinds to the expected frame.
+ *  The sender can have up to FRAME_WINDOW frames unacknowledged: one frame being
+ *  processed by the MCU and the rest waiting in the serial RX buffer.
+ *
+ *  The fuse-map read-back uses the same frames in the opposite direction. They carry
+ *  up to FRAME_READ_PAYLOAD bytes and are not acknowledged: the PC software checks
+ *  the CRC and the sequence and reads the fuse map again in the text form on error.
+ *  When streaming, a frame with FRAME_ADDR_ROW set in the addr carries one GAL fuse row:
+ *  payload bit i is the fuse (row + rows * i). The fuses after the fuse rows follow
+ *  in one frame and the end frame addr holds the total fuse count (with the APD fuse).
+ *
+ *  The streamed verify sends the expected fuse rows to the MCU in the row frames
+ *  (up to FRAME_ROW_PAYLOAD bytes) and they are acknowledged as the uploaded frames.
+ */
+
+#define FRAME_HEADER_SIZE 4
+#define FRAME_CRC_SIZE 2
+#define FRAME_MAX_PAYLOAD 16
+#define FRAME_MAX_SIZE (FRAME_HEADER_SIZE + FRAME_MAX_PAYLOAD + FRAME_CRC_SIZE)
+#define FRAME_READ_PAYLOAD 64
+#define FRAME_ADDR_ROW 0x8000
+#define FRAME_ROW_PAYLOAD 22
+#define FRAME_ROW_SIZE (FRAME_HEADER_SIZE + FRAME_ROW_PAYLOAD + FRAME_CRC_SIZE)
+
+#define FRAME_ACK 0x06
+#define FRAME_NAK 0x15
+
+// frameReceive() error codes
+#define FRAME_ERR_TIMEOUT -1
+#define FRAME_ERR_CORRUPTED -2
+
+// silence period (ms) which ends the input discarding after a rejected frame
+#define FRAME_QUIET_TIME 10
+
+// number of consecutive receive timeouts that abort the transfer
+#define FRAME_MAX_TIMEOUTS 3
+
+#ifdef SERIAL_RX_BUFFER_SIZE
+#define FRAME_RX_BUFFER_SIZE SERIAL_RX_BUFFER_SIZE
+#else
+#define FRAME_RX_BUFFER_SIZE 64
+#endif
+
+#define FRAME_WINDOW ((FRAME_RX_BUFFER_SIZE / FRAME_MAX_SIZE) + 1)
+// the row frame is read from the serial RX buffer only after the GAL row is read,
+// so all the unacknowledged row frames must fit in the RX buffer
+#define FRAME_ROW_WINDOW (FRAME_RX_BUFFER_SIZE / FRAME_ROW_SIZE)
+
+static uint16_t frameCrc16(uint16_t crc, const uint8_t* data, uint8_t len) {
+  while (len--) {
+    uint8_t i;
+    crc ^= ((uint16_t) *data++) << 8;
+    for (i = 0; i < 8; i++) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+    }
+  }
+  return crc;
+}
+
+// Reads one frame with up to 'maxLen' bytes of payload into the 'frame' buffer.
+// Returns the payload length or FRAME_ERR_* code.
+static int8_t frameReceive(uint8_t* frame, uint8_t maxLen) {
+  uint8_t len;
+  uint8_t size;
+  uint16_t crc;
+
+  if (Serial.readBytes(frame, 1) != 1) {
+    return FRAME_ERR_TIMEOUT;
+  }
+  len = frame[0];
+  if (len > maxLen) {
+    return FRAME_ERR_CORRUPTED;
+  }
+  size = FRAME_HEADER_SIZE - 1 + len + FRAME_CRC_SIZE;
+  if (Serial.readBytes(frame + 1, size) != size) {
+    return FRAME_ERR_CORRUPTED;
+  }
+  crc = frameCrc16(0xFFFF, frame, FRAME_HEADER_SIZE + len);
+  if ((crc & 0xFF) != frame[FRAME_HEADER_SIZE + len] || (crc >> 8) != frame[FRAME_HEADER_SIZE + len + 1]) {
+    return FRAME_ERR_CORRUPTED;
+  }
+  return len;
+}
+
+// Sends one frame with the payload (up to FRAME_READ_PAYLOAD bytes).
+static void frameSend(uint8_t seq, uint16_t addr, const uint8_t* payload, uint8_t len) {
+  uint8_t header[FRAME_HEADER_SIZE];
+  uint16_t crc;
+
+  header[0] = len;
+  header[1] = seq;
+  header[2] = addr & 0xFF;
+  header[3] = addr >> 8;
+  crc = frameCrc16(0xFFFF, header, FRAME_HEADER_SIZE);
+  crc = frameCrc16(crc, payload, len);
+  Serial.write(header, FRAME_HEADER_SIZE);
+  Serial.write(payload, len);
+  Serial.write((uint8_t) (crc & 0xFF));
+  Serial.write((uint8_t) (crc >> 8));
+}
+
+static void frameReply(uint8_t code, uint8_t seq) {
+  Serial.write(code);
+  Serial.write(seq);
+}
+
+// Rejects the current frame and discards the rest of the window already sent by the host.
+static void frameReject(uint8_t expectedSeq) {
+  frameReply(FRAME_NAK, expectedSeq);
+  do {
+    while (Serial.available() > 0) {
+      Serial.read();
+    }
+    delay(FRAME_QUIET_TIME);
+  } while (Serial.available() > 0);
+}
+
+// Reads the frame 'expectedSeq': rejects the corrupted frames and acknowledges the repeated ones.
+// The caller acknowledges the frame once it is processed.
+// Returns the payload length or FRAME_ERR_TIMEOUT when the host stopped sending.
+static int8_t frameReceiveNext(uint8_t* frame, uint8_t expectedSeq, uint8_t maxLen) {
+  uint8_t timeouts = 0;
+
+  while (1) {
+    int8_t len = frameReceive(frame, maxLen);
+
+    if (len == FRAME_ERR_TIMEOUT) {
+      if (++timeouts >= FRAME_MAX_TIMEOUTS) {
+        return FRAME_ERR_TIMEOUT;
+      }
+      continue;
+    }
+    timeouts = 0;
+    if (len == FRAME_ERR_CORRUPTED) {
+      frameReject(expectedSeq);
+      continue;
+    }
+    if (frame[1] != expectedSeq) {
+      // repeated frame which was already processed (the host missed the ack)
+      if ((uint8_t)(expectedSeq - frame[1]) <= FRAME_WINDOW) {
+        frameReply(FRAME_ACK, frame[1]);
+      } else {
+        frameReject(expectedSeq);
+      }
+      continue;
+    }
+    return len;
+  }
+}
+
+#endif /* _AFTB_FRAME_H_ */
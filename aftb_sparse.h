@@ -3,16 +3,27 @@
  * 
  *  The idea of sparse fuse map is to store non-zero fuse bits only.
  *  The reason is to fit big fusemaps into a size-limited SRAM.
- *  The fusemap is divided into groups of 16 bits and each group
- *  has a 'type' bit stored in fuseTypes array. Group type 0 has
- *  all 16 fuesmap bits 0 and is not stored in fusemap array.
- *  Group type 1 has at least 1 fusemap bit set and is stored in 
- *  fusemap array. Position of group type '1' in the fusemap array
- *  may vary based on which fuses are written.
+ *  The fusemap is divided into groups of 32 bits and each group
+ *  has a 2 bit 'type' stored in fuseType array:
+ *  - type 0: all 32 fuse bits are 0, the group is not stored
+ *  - type 1: the group is stored in the ordered area at the start
+ *            of fusemap array, in the order of the group index
+ *  - type 2: the group is stored in the append area: a small hash table
+ *            at the end of fusemap array, keyed by the group index
+ *  - type 3: all 32 fuse bits are 1, the group is not stored
+ *
+ *  A group receiving its first bit is appended in constant time. The
+ *  appended groups are merged into the ordered area in one linear pass
+ *  once the append area is filled up, the same pass drops the groups
+ *  that have all bits set. When the ordered area grows into the append
+ *  area the groups are inserted into the ordered area directly.
  *
  *  Sparse fusemap supports:
  *  - random reads and writes
- *  - a simple cache to speed up index look-ups.
+ *  - a prefix-count index to speed up index look-ups: for every
+ *    SPINDEX_STEP bytes of fuseType array the index holds the fusemap
+ *    byte offset of the first group stored in that block. Any fuse
+ *    position is then resolved by scanning at most SPINDEX_STEP bytes.
  */
 
 #ifdef USE_SPARSE_FUSEMAP
@@ -23,12 +34,23 @@
 #define SPFUSES 128
 unsigned char fuseType[SPFUSES]; //sparse fuses index
 
-uint16_t sparseFusemapStat = 0; //bit 15: use sparse fusemaps, bits 0-11 : sparse fusemap size in bytes
-uint8_t  sparseCompactCounter = 0;
-uint16_t sparseCacheBitPos = 0;
-uint16_t sparseCacheOffset = 0;
-uint16_t  sparseCacheHit = 0;
-uint8_t  sparseCacheIndex = 0;
+// prefix-count index: fusemap byte offset at each block of SPINDEX_STEP fuseType bytes
+#define SPINDEX_STEP 16
+#define SPINDEX (SPFUSES / SPINDEX_STEP)
+uint16_t fuseIndex[SPINDEX];
+
+// append area entry: group index (2 bytes) followed by the 4 bytes of the group
+#define SPAPPEND_ENTRY 6
+#define SPAPPEND_SLOTS 32
+#define SPAPPEND_BASE (MAXFUSES - SPAPPEND_SLOTS * SPAPPEND_ENTRY)
+// merge threshold, keeps the hash probe sequences short
+#define SPAPPEND_MAX 24
+#define SPAPPEND_EMPTY 0xFF
+// returned when an appended group is not found
+#define SPAPPEND_MISSING 0xFFFF
+
+uint16_t sparseFusemapStat = 0; //bit 15: use sparse fusemaps, bits 0-11 : ordered area size in bytes
+uint8_t  sparseAppendCount = 0;
 
 #if COMPACT_STAT
 uint8_t sparseCompactRun = 0;
@@ -36,94 +58,118 @@ uint8_t sparseCompactAct = 0;
 #endif
 
 
-// reverse search of the fuse group index based on the byte position in the sparse array
-// returns the group index
-static uint16_t getFuseGroupIndex(uint16_t fuseOffsetBytePos) {
-  uint16_t groupPos = 0;
-  uint16_t i = 0;
+// returns the number of groups with type 1 (stored in fusemap) in a fuseType byte
+static inline uint8_t sparseStoredGroups(uint8_t rec) {
+  uint8_t m = rec & ~(rec >> 1) & 0b01010101; // low bit set, high bit clear
+  m = (m & 0b00110011) + ((m >> 2) & 0b00110011);
+  return (m & 0xF) + (m >> 4);
+}
+
+// adds 'delta' bytes to the index of all blocks following the fuse group
+static void sparseUpdateIndex(uint16_t group, int8_t delta) {
+  uint8_t k;
+  for (k = (group >> 2) / SPINDEX_STEP + 1; k < SPINDEX; k++) {
+    fuseIndex[k] += delta;
+  }
+}
+
+// recalculates the whole prefix-count index from the fuseType array
+static void sparseBuildIndex(void) {
   uint16_t fuseOffset = 0;
+  uint8_t i;
+  for (i = 0; i < SPFUSES; i++) {
+    if ((i % SPINDEX_STEP) == 0) {
+      fuseIndex[i / SPINDEX_STEP] = fuseOffset;
+    }
+    fuseOffset += sparseStoredGroups(fuseType[i]) << 2;
+  }
+}
 
-  //calculate fusemap offset
-  while (1) {
-    uint8_t rec = fuseType[i];
-    // speed optimised special case: all 8 bits are 0 (4 * 32 bits)
-    if (rec == 0) {
-        groupPos += 4; //4 groups in the byte
-    } else {
-      uint8_t j = 0;
-      //4 types per byte
-      while (j < 4) {
-        if ((rec & 0b11) == 1) { // type 0 & 3 - no byte stored in fusemap
-          if (fuseOffset == fuseOffsetBytePos) {
-              return groupPos;
-          }
-          fuseOffset += 4; // 32 bits in the group, fuse byte offset advances by 4 bytes
-        }
-        groupPos++; //check next group
-        rec >>= 2;
-        j++;
-      }
+static inline void sparseSetType(uint16_t group, uint8_t type) {
+  uint8_t shift = (group & 0b11) << 1;
+  fuseType[group >> 2] = (fuseType[group >> 2] & ~(0b11 << shift)) | (type << shift);
+}
+
+static inline uint8_t sparseGetType(uint16_t group) {
+  return (fuseType[group >> 2] >> ((group & 0b11) << 1)) & 0b11;
+}
+
+// returns the fusemap byte position of the data of an appended group.
+// The entries are never removed one by one: the probe stops at an empty slot.
+// A group missing in the append area gets type 0 and SPAPPEND_MISSING is returned.
+static uint16_t sparseFindAppended(uint16_t group) {
+  uint8_t slot = group & (SPAPPEND_SLOTS - 1);
+  uint8_t n;
+  for (n = 0; n < SPAPPEND_SLOTS; n++) {
+    uint16_t e = SPAPPEND_BASE + slot * SPAPPEND_ENTRY;
+    if (fusemap[e] == (group & 0xFF) && fusemap[e + 1] == (group >> 8)) {
+      return e + 2;
+    }
+    if (fusemap[e + 1] == SPAPPEND_EMPTY) {
+      break;
     }
-    i++; //next byte from the fuseTypes
+    slot = (slot + 1) & (SPAPPEND_SLOTS - 1);
   }
+  sparseSetType(group, 0);
+  return SPAPPEND_MISSING;
 }
 
+// marks all entries of the append area as empty
+static void sparseClearAppended(void) {
+  uint8_t slot;
+  for (slot = 0; slot < SPAPPEND_SLOTS; slot++) {
+    fusemap[SPAPPEND_BASE + slot * SPAPPEND_ENTRY + 1] = SPAPPEND_EMPTY;
+  }
+  sparseAppendCount = 0;
+}
+
+// checks the append area has room for one more group, the ordered area
+// must still fit below the append area once all appended groups are merged
+static inline char sparseAppendFits(void) {
+  return sparseAppendCount < SPAPPEND_MAX &&
+    (sparseFusemapStat & 0x7FF) + 4 * (sparseAppendCount + 1) <= SPAPPEND_BASE;
+}
 
 // get position of the fuse bit in the sparse array
 static uint16_t getFusePositionAndType(uint16_t bitPos) {
-  uint16_t counter = 0;
-  uint8_t i = 0;
-  uint8_t type;
-  uint16_t fuseOffset = (bitPos & 0b11000)  >> 3; //set odd / even byte of the fuse offset
-
-  if (bitPos <= sparseCacheBitPos) {
-    sparseCacheBitPos = 0;
-    sparseCacheOffset = 0;
-    sparseCacheIndex = 0;
-  } else {
-    counter = sparseCacheBitPos;
-    fuseOffset += sparseCacheOffset & 0xFFC;
-    i = sparseCacheIndex;
-    sparseCacheHit++;
+  uint8_t last = bitPos >> 7; // fuseType byte holding the group (128 bits per byte)
+  uint8_t i = (last / SPINDEX_STEP) * SPINDEX_STEP;
+  uint8_t rec;
+  uint8_t j;
+  uint16_t fuseOffset = fuseIndex[last / SPINDEX_STEP];
+
+  // bounded scan from the start of the index block
+  while (i < last) {
+    fuseOffset += sparseStoredGroups(fuseType[i]) << 2;
+    i++;
   }
 
-  //calculate fusemap offset
-  while (1) {
-    uint8_t rec = fuseType[i];
-    // speed optimised special case: all 8 bits are 0 or all are 1 (4 * 32 bits)
-    if (rec == 0 || rec == 0xFF) {
-        counter += 128;
-        if (counter > bitPos) {
-          return (fuseOffset << 2) | (rec & 0b11); // type is 0 or 3
-        }
-        sparseCacheBitPos = counter;
-        sparseCacheOffset = fuseOffset;
-        sparseCacheIndex = i + 1;
+  // groups preceding the fuse group in the same fuseType byte
+  rec = fuseType[last];
+  j = (bitPos >> 5) & 0b11;
+  while (j--) {
+    if ((rec & 0b11) == 1) {
+      fuseOffset += 4;
     }
-    else {
-      uint8_t j = 0;
-      //4 fuse types per byte
-      while (j < 4) {
-        counter += 32;
-        type = rec & 0b11;
-        if (counter > bitPos) {
-          return (fuseOffset << 2) | type;
-        }
-        if (type == 1) { // type 0 & 3 - no byte stored in fusemap
-          fuseOffset += 4;
-        }
-        rec >>= 2;
-        j++;
-      }
+    rec >>= 2;
+  }
+  if ((rec & 0b11) == 2) {
+    uint16_t appended = sparseFindAppended(bitPos >> 5);
+    if (appended == SPAPPEND_MISSING) {
+      rec = 0; // the group was reset to type 0, its data position is the ordered one
+    } else {
+      fuseOffset = appended;
     }
-    i++; //next byte from the fuseTypes
   }
+  fuseOffset += (bitPos & 0b11000) >> 3; //set the byte within the group
+  return (fuseOffset << 2) | (rec & 0b11);
 }
 
 static void insertFuseGroup(uint16_t dataPos, uint16_t bitPos) {
   int16_t i = bitPos >> 5; //group index
   uint16_t totalFuseBytes = sparseFusemapStat & 0x7FF; // max is 2048 bytes
   fuseType[i >> 2] |= (1 << ((i & 0b11) << 1)); // set type 1 at the fuse group record
+  sparseUpdateIndex(i, 4);
 
   //shift all data in the fuse map  starting at data pos by 4 bytes (32 bits)
   if (dataPos < totalFuseBytes) {
@@ -131,7 +177,7 @@ static void insertFuseGroup(uint16_t dataPos, uint16_t bitPos) {
       fusemap[i + 4] = fusemap[i];
     }
   }
-  sparseFusemapStat = totalFuseBytes + 4; // we can ignore the sparse bit
+  sparseFusemapStat = (1 << 15) | (totalFuseBytes + 4);
   //clean the emptied fusemap data
   fusemap[dataPos++] = 0;
   fusemap[dataPos++] = 0;
@@ -140,72 +186,197 @@ static void insertFuseGroup(uint16_t dataPos, uint16_t bitPos) {
 }
 
 
-static void sparseCompactFuseMap(void) {
-  uint16_t i, j;
-  uint16_t total = (sparseFusemapStat & 0x7FF) >> 2; // max is 2048 bytes, and convert to the group index
-  uint32_t* fuses = (uint32_t*) fusemap;
-
-  if (total < 2) {
-    return;
+// appends a new group with all bits 0, returns the fusemap position of its data
+static uint16_t appendFuseGroup(uint16_t group) {
+  uint8_t slot = group & (SPAPPEND_SLOTS - 1);
+  uint16_t e = SPAPPEND_BASE + slot * SPAPPEND_ENTRY;
+  while (fusemap[e + 1] != SPAPPEND_EMPTY) {
+    slot = (slot + 1) & (SPAPPEND_SLOTS - 1);
+    e = SPAPPEND_BASE + slot * SPAPPEND_ENTRY;
   }
+  sparseAppendCount++;
+  sparseSetType(group, 2);
+  fusemap[e++] = group & 0xFF;
+  fusemap[e++] = group >> 8;
+  fusemap[e] = 0;
+  fusemap[e + 1] = 0;
+  fusemap[e + 2] = 0;
+  fusemap[e + 3] = 0;
+  return e;
+}
+
+// checks all 4 bytes of a fuse group are 0xFF
+static inline char sparseGroupIsFull(uint16_t pos) {
+  return fusemap[pos] == 0xFF && fusemap[pos + 1] == 0xFF && fusemap[pos + 2] == 0xFF && fusemap[pos + 3] == 0xFF;
+}
+
+// merges the appended groups into the ordered area and drops the groups
+// that have all bits set
+static void sparseMergeFuseMap(void) {
+  uint16_t total = sparseFusemapStat & 0x7FF;
+  uint16_t r = 0;
+  uint16_t w = 0;
+  uint16_t g;
+  uint8_t i;
 
 #if COMPACT_STAT
   sparseCompactRun++; //statistics
 #endif
 
+  // drop appended groups with all bits 1
+  for (i = 0; i < SPAPPEND_SLOTS && sparseAppendCount; i++) {
+    uint16_t e = SPAPPEND_BASE + i * SPAPPEND_ENTRY;
+    if (fusemap[e + 1] != SPAPPEND_EMPTY && sparseGroupIsFull(e + 2)) {
+      sparseSetType(fusemap[e] | (fusemap[e + 1] << 8), 3);
+      sparseAppendCount--;
+    }
+  }
 
-  i = total - 1;
-  while(i) {
-    // remove 4 fusemap bytes at a position when the bits are all 1's
-    if (fuses[i] == 0xFFFFFFFF) {
-      if (i < total - 1) {
-        uint16_t fuseGroup = getFuseGroupIndex(i << 2); //ensure the int32 index is converted to int8/byte index
+  // forward pass: remove groups with all bits 1 from the ordered area
+  for (g = 0; r < total; g++) {
+    if (sparseGetType(g) == 1) {
+      if (sparseGroupIsFull(r)) {
+        sparseSetType(g, 3);
 #if COMPACT_STAT
         sparseCompactAct++; //statistics
 #endif
-        /// shift the fuses by 4 bytes to the left
-        for (j = i; j < total - 1 ; j++) {
-          fuses[j] = fuses[j + 1];
+      } else {
+        for (i = 0; i < 4; i++) {
+          fusemap[w + i] = fusemap[r + i];
         }
-        total--;
-        fuseType[fuseGroup >> 2] |= (3 << ((fuseGroup & 0b11) << 1)); //set type 3 at the fuse group record
-        sparseFusemapStat -= 4; // fuse map total size reduced by 4 bytes
+        w += 4;
       }
+      r += 4;
     }
-    i--;
   }
-  //destory cache
-  sparseCacheBitPos = 0;
-  sparseCacheOffset = 0;
-  sparseCacheIndex = 0;
+  total = w;
+
+  // backward pass: move the ordered groups up to make space for the appended ones
+  r = total;
+  w = total + (sparseAppendCount << 2);
+  g = SPFUSES * 4;
+  while (w != r) {
+    uint16_t src;
+    g--;
+    switch (sparseGetType(g)) {
+    case 1:
+      r -= 4;
+      src = r;
+      break;
+    case 2:
+      src = sparseFindAppended(g);
+      if (src == SPAPPEND_MISSING) {
+        continue;
+      }
+      sparseSetType(g, 1);
+      break;
+    default:
+      continue;
+    }
+    w -= 4;
+    for (i = 0; i < 4; i++) {
+      fusemap[w + i] = fusemap[src + i];
+    }
+  }
+
+  total += sparseAppendCount << 2;
+  sparseFusemapStat = (1 << 15) | total;
+  sparseAppendCount = 0;
+  // the ordered area may have grown into the append area by direct inserts
+  if (total <= SPAPPEND_BASE) {
+    sparseClearAppended();
+  }
+  sparseBuildIndex();
+
 #if COMPACT_STAT
   Serial.print(F("sp comp:"));
   Serial.print(sparseCompactRun, DEC);
   Serial.print(F(" total:"));
   Serial.println(sparseFusemapStat & 0x7FF, DEC);
-
-#endif  
+#endif
 }
 
-static inline uint16_t sparseSetFuseBit(uint16_t bitPos) {
+// returns the fusemap byte position of the fuse bit for writing, allocates the
+// group when it has all bits 0 so far. Returns 0xFFFF when the group has all bits 1
+// or there is no space left.
+static uint16_t sparseGetWritePos(uint16_t bitPos) {
+    uint16_t total = sparseFusemapStat & 0x7FF;
     uint8_t type;
-    uint16_t pos;
-
-    //try to reduce the size of the fuse map by finding and removing blocks with all 1's
-    sparseCompactCounter ++;
-    if (sparseCompactCounter == 255) {
-      sparseCompactFuseMap();
-    }
+    uint16_t pos = getFusePositionAndType(bitPos);
 
-    pos = getFusePositionAndType(bitPos);
     type = pos & 0b11;
     pos >>= 2; //trim the type to get the byte position in fuse map
+    if (type == 3) { // the bit is already set
+      return 0xFFFF;
+    }
     if (type == 0) { //we need to write the bit into a group that has all bits 0 so far
-      insertFuseGroup(pos & 0x7FC, bitPos);
+      // in-order writes (upload) add the groups at the end of the ordered area in constant time
+      if ((pos & 0x7FC) == total && !sparseAppendCount && total + 4 <= MAXFUSES) {
+        insertFuseGroup(total, bitPos);
+        return pos;
+      }
+      // merge when the append area is filled up, or to drop the full groups
+      // when the ordered area has no space left
+      if (!sparseAppendFits() && (sparseAppendCount || total + 4 > MAXFUSES)) {
+        sparseMergeFuseMap();
+        pos = getFusePositionAndType(bitPos) >> 2;
+      }
+      if (sparseAppendFits()) {
+        pos = appendFuseGroup(bitPos >> 5) + ((bitPos & 0b11000) >> 3);
+      } else if ((sparseFusemapStat & 0x7FF) + 4 <= MAXFUSES) {
+        // the fusemap is nearly full: insert directly into the ordered area
+        insertFuseGroup(pos & 0x7FC, bitPos);
+      } else {
+        return 0xFFFF; // no space left
+      }
     }
     return pos;
 }
 
+// sets the bits of 'v' (LSb first) starting at the fuse position, all bits must be in one group
+static void sparseSetGroupBits(uint16_t bitPos, uint8_t v) {
+    uint8_t shift = bitPos & 7;
+    uint16_t pos;
+    uint16_t total;
+
+    if (!v) {
+      return;
+    }
+    pos = sparseGetWritePos(bitPos);
+    if (pos == 0xFFFF) {
+      return;
+    }
+    fusemap[pos] |= v << shift;
+    if (shift && (v >> (8 - shift))) {
+      fusemap[pos + 1] |= v >> (8 - shift);
+    }
+
+    // the last group of the ordered area is dropped as soon as all its bits are set,
+    // so that in-order writes do not fill the fusemap with full groups
+    total = sparseFusemapStat & 0x7FF;
+    pos -= (bitPos & 0b11000) >> 3; //start of the group
+    if (pos + 4 == total && sparseGroupIsFull(pos)) {
+      sparseSetType(bitPos >> 5, 3);
+      sparseUpdateIndex(bitPos >> 5, -4);
+      sparseFusemapStat -= 4;
+    }
+}
+
+static inline void sparseSetFuseBit(uint16_t bitPos) {
+    sparseSetGroupBits(bitPos, 1);
+}
+
+// sets the bits of 'v' (LSb first) at fuse positions bitPos .. bitPos + 7
+static void sparseSetFuseByte(uint16_t bitPos, uint8_t v) {
+    uint8_t n = 32 - (bitPos & 31); //bits left in the group
+    if (n < 8) {
+      sparseSetGroupBits(bitPos, v & ((1 << n) - 1));
+      sparseSetGroupBits(bitPos + n, v >> n);
+    } else {
+      sparseSetGroupBits(bitPos, v);
+    }
+}
+
 static inline uint16_t sparseGetFuseBit(uint16_t bitPos) {
     uint8_t type;
     uint16_t pos = getFusePositionAndType(bitPos);
@@ -221,11 +392,18 @@ static inline uint16_t sparseGetFuseBit(uint16_t bitPos) {
     return pos;
 }
 
+// returns 8 fuse bits from a byte position
+static uint8_t sparseGetFuseByte(uint16_t bytePos) {
+    uint16_t pos = sparseGetFuseBit(bytePos << 3);
+    if (pos >= 0xFF00) {
+      return (pos & 1) ? 0xFF : 0;
+    }
+    return fusemap[pos];
+}
+
 static void sparsePrintStat() {
     Serial.print(F("sp bytes="));
     Serial.println(sparseFusemapStat & 0x7FF, DEC);
-    Serial.print(F("c_hit="));
-    Serial.println(sparseCacheHit, DEC);
 #if COMPACT_STAT
     Serial.print(F("compact run="));
     Serial.print(sparseCompactRun, DEC);
@@ -234,19 +412,16 @@ static void sparsePrintStat() {
 #endif
 }
 
-static void sparseInit(char clearArray) {
-  if (clearArray) {
-    uint8_t i;
-    for (i = 0; i < SPFUSES; i++) {
-      fuseType[i] = 0;
-    }
-
+// empties the sparse fusemap: the group types are cleared together with the ordered
+// and the append area, a group left with type 1 or 2 would point to stale data
+static void sparseInit(void) {
+  uint8_t i;
+  for (i = 0; i < SPFUSES; i++) {
+    fuseType[i] = 0;
   }
   sparseFusemapStat = (1 << 15);
-  sparseCompactCounter = 0;
-  sparseCacheBitPos = 0;
-  sparseCacheOffset = 0;
-  sparseCacheIndex = 0;
+  sparseClearAppended();
+  sparseBuildIndex();
 #if COMPACT_STAT
   sparseCompactRun = 0;
   sparseCompactAct = 0;
@@ -258,9 +433,11 @@ static inline void sparseDisable(void) {
 #else /* ! USE_SPARSE_FUSEMAP */
 
 #define sparseDisable()
-#define sparseInit(X)
+#define sparseInit()
 #define sparseGetFuseBit(X) 0
-#define sparseSetFuseBit(X) 0
+#define sparseGetFuseByte(X) 0
+#define sparseSetFuseBit(X)
+#define sparseSetFuseByte(X, V)
 #define sparsePrintStat()
 #define sparseFusemapStat 0
 #endif
@@ -19,6 +19,16 @@ This port:
 
 * reduces the code to a single .h file
 
+* streams the XSVF data with credits: the player announces free space
+  of its receive buffer by "$NNN" feed requests ahead of consumption,
+  so the host can keep several chunks in flight while TAP is shifted.
+  With XSVF_HEAP the receive buffer takes the rest of the heap.
+
+* optionally decompresses the XSVF stream (LZSS, XSVF_LZ_WINDOW bytes
+  history): each group of 8 items is preceded by a flag byte (LSB first).
+  Flag 0: a literal byte follows. Flag 1: a match follows - 2 bytes:
+  distance - 1 and length - 3 of the bytes to copy from the history.
+
 Use the original JTAG libray python scripts to upload XSVF files
 from your PC:
 ./xsvf -p /dev/ttyACM0 my_file.xsvf
@@ -35,13 +45,28 @@ Arduino usage:
   jport.tck = 3;
   jport.vref = 10;
 
-  //process XSVF data received from serial port
-  jtag_play_xsvf(&jport);
+  //process XSVF data received from serial port (0: plain, 1: compressed)
+  jtag_play_xsvf(&jport, 0);
 
 */
 
-//value bigger than 63 may cause reading errors on AVR MCUs.
-#define XSVF_BUF_SIZE 62
+// Receive buffer is granted to the host in chunks. The granted data which was not
+// moved to the receive buffer yet must fit into the serial RX buffer of the MCU,
+// which holds one byte less than its size.
+#define XSVF_CHUNK_SIZE 32
+#ifdef SERIAL_RX_BUFFER_SIZE
+#define XSVF_RX_BUFFER_SIZE SERIAL_RX_BUFFER_SIZE
+#else
+#define XSVF_RX_BUFFER_SIZE 64
+#endif
+// maximal receive buffer size (feed request has 3 digits)
+#define XSVF_BUF_MAX 512
+// receive buffer size without XSVF_HEAP
+#define XSVF_BUF_SIZE 256
+// time to wait for the granted data (ms)
+#define XSVF_RX_TIMEOUT 16000
+// history size of the compressed stream, must be a power of 2
+#define XSVF_LZ_WINDOW 128
 
 #define XSVF_DEBUG 0
 #define XSVF_CALC_CSUM 1
@@ -204,12 +229,25 @@ typedef struct xsvf_t {
   uint8_t* xsvf_address_mask;
   uint8_t* xsvf_data_mask;
 
-  uint32_t rdpos;
-  uint32_t wrpos;
+  uint32_t rdpos;   // total bytes consumed
+  uint32_t wrpos;   // total bytes received
+  uint32_t granted; // total bytes the host was allowed to send
+
+  uint16_t buf_size;
+  uint16_t buf_rd;  // read index in the receive buffer
+  uint16_t buf_wr;  // write index in the receive buffer
 
   #if XSVF_CALC_CSUM
   uint32_t csum;
   #endif
+  uint32_t outpos;  // total bytes of the XSVF stream (decompressed)
+
+  uint8_t  lz;      // the stream is compressed
+  uint8_t  lz_flags;
+  uint8_t  lz_bits; // flags left in lz_flags
+  uint8_t  lz_pos;  // write index in the history
+  uint8_t  lz_dist;
+  uint16_t lz_len;  // bytes left to copy from the history
 
   uint16_t instruction_counter;
   uint8_t  error;
@@ -237,12 +275,14 @@ typedef struct xsvf_t {
 #ifdef XSVF_HEAP
 // variables will be allocated on heap
 uint8_t* xsvf_buf;
+uint8_t* xsvf_lz_hist;
 xsvf_t* xsvf;
 uint8_t* xsvf_tms_transitions;
 uint16_t* xsvf_tms_map;
 #else /* XSVF_HEAP */
 // variables allocated globally
 uint8_t xsvf_buf[XSVF_BUF_SIZE];
+uint8_t xsvf_lz_hist[XSVF_LZ_WINDOW];
 uint8_t xsvf_tdo_mask[S_MAX_CHAIN_SIZE_BYTES];
 uint8_t xsvf_tdi[S_MAX_CHAIN_SIZE_BYTES];
 uint8_t xsvf_tdo[S_MAX_CHAIN_SIZE_BYTES];
@@ -307,47 +347,116 @@ static inline uint8_t jtag_port_get_veref(jtag_port_t* port) {
 }
 
 
-static uint8_t  xsvf_player_next_byte(void) {
-  uint8_t retry = 16;
-  uint8_t pos =  xsvf->rdpos % XSVF_BUF_SIZE;
+// moves the received bytes from the serial RX buffer into the receive buffer
+static void xsvf_player_pump(void) {
+  while (xsvf->wrpos != xsvf->granted && Serial.available() > 0) {
+    xsvf_buf[xsvf->buf_wr] = Serial.read();
+    if (++xsvf->buf_wr == xsvf->buf_size) {
+      xsvf->buf_wr = 0;
+    }
+    xsvf->wrpos++;
+  }
+}
 
-  if (xsvf->wrpos == xsvf->rdpos) {
-    size_t r = 0;
-    while (r == 0) {
-#if XSVF_DEBUG
-      Serial.println("D<<< req read"); // request to receive BUF size bytes
-#endif
-      Serial.println(F("$062")); // request to receive BUF size bytes
-      r = Serial.readBytes(xsvf_buf + pos, XSVF_BUF_SIZE - pos);
+// grants the free space of the receive buffer to the host in whole chunks,
+// limited by the free space of the serial RX buffer
+static void xsvf_player_grant(void) {
+  uint16_t space = xsvf->buf_size - (uint16_t)(xsvf->granted - xsvf->rdpos);
+  uint16_t rxSpace = (XSVF_RX_BUFFER_SIZE - 1) - (uint16_t)(xsvf->granted - xsvf->wrpos);
+
+  if (space > rxSpace) {
+    space = rxSpace;
+  }
+  // the host sends the first chunk twice: grant half of the free space
+  if (xsvf->granted == 0) {
+    space /= 2;
+    xsvf->granted = space;
+  } else {
+    if (space < XSVF_CHUNK_SIZE) {
+      return;
+    }
+    space -= space % XSVF_CHUNK_SIZE;
+  }
+  xsvf->granted += space;
 #if XSVF_DEBUG
-      Serial.print("D<<< read "); // request to receive BUF size bytes
-      Serial.println(r, DEC); // request to receive BUF size bytes
+  Serial.println("D<<< grant"); // request to receive BUF size bytes
 #endif
-      if (r == 0) {
-        retry --;
-        if (retry == 0) {
-          xsvf->error = 1;
-          return 0;
-        }
-        delay(1);
-      } else {
-        xsvf->wrpos += r;
+  // request to receive 'space' bytes: $NNN
+  Serial.print('$');
+  if (space < 100) {
+    Serial.print('0');
+  }
+  if (space < 10) {
+    Serial.print('0');
+  }
+  Serial.println(space, DEC);
+}
+
+static uint8_t  xsvf_player_next_raw_byte(void) {
+  uint8_t b;
+
+  xsvf_player_pump();
+  if (xsvf->wrpos == xsvf->rdpos) {
+    uint32_t start = millis();
+    xsvf_player_grant();
+    while (xsvf->wrpos == xsvf->rdpos) {
+      if (millis() - start > XSVF_RX_TIMEOUT) {
+        xsvf->error = ERR_IO;
+        return 0;
       }
+      xsvf_player_pump();
     }
   }
 
+  b = xsvf_buf[xsvf->buf_rd];
+  if (++xsvf->buf_rd == xsvf->buf_size) {
+    xsvf->buf_rd = 0;
+  }
   xsvf->rdpos++;
+  // keep the host sending while there is space
+  xsvf_player_grant();
+  return b;
+}
+
+static uint8_t  xsvf_player_next_byte(void) {
+  uint8_t b;
+
+  if (xsvf->lz) {
+    if (xsvf->lz_len == 0) {
+      if (xsvf->lz_bits == 0) {
+        xsvf->lz_flags = xsvf_player_next_raw_byte();
+        xsvf->lz_bits = 8;
+      }
+      xsvf->lz_bits--;
+      if (xsvf->lz_flags & 1) {
+        xsvf->lz_dist = xsvf_player_next_raw_byte() + 1;
+        xsvf->lz_len = xsvf_player_next_raw_byte() + 3;
+      }
+      xsvf->lz_flags >>= 1;
+    }
+    if (xsvf->lz_len) {
+      xsvf->lz_len--;
+      b = xsvf_lz_hist[(uint8_t)(xsvf->lz_pos - xsvf->lz_dist) & (XSVF_LZ_WINDOW - 1)];
+    } else {
+      b = xsvf_player_next_raw_byte();
+    }
+    xsvf_lz_hist[xsvf->lz_pos++ & (XSVF_LZ_WINDOW - 1)] = b;
+  } else {
+    b = xsvf_player_next_raw_byte();
+  }
+  xsvf->outpos++;
+
 #if XSVF_DEBUG
    Serial.print(F("D BYTE "));
-   Serial.print(xsvf_buf[pos], DEC);
+   Serial.print(b, DEC);
    Serial.print(F(" 0x"));
-   Serial.println(xsvf_buf[pos], HEX);
+   Serial.println(b, HEX);
 #endif
 #if XSVF_CALC_CSUM
-   xsvf->csum += xsvf_buf[pos];
+   xsvf->csum += b;
 #endif
 
-  return xsvf_buf[pos];
+  return b;
 }
 
 static uint8_t xsvf_player_get_next_byte(void) {
@@ -380,10 +489,14 @@ static void xsvf_player_get_next_bytes(uint8_t* data, uint32_t count) {
 }
 
 #ifdef XSVF_HEAP
+// heap allocations start on 4 byte boundaries, each can waste up to XSVF_HEAP_ALIGN_PAD bytes
+#define XSVF_HEAP_ALIGN 4
+#define XSVF_HEAP_ALIGN_PAD (XSVF_HEAP_ALIGN - 1)
+
 static uint32_t xsvf_heap_pos(uint32_t* pos, uint16_t size) {
   uint32_t heap_pos = *pos;
   //allocate on 4 byte boundaries
-  heap_pos = (heap_pos + 3) & 0xFFFFFFFC;
+  heap_pos = (heap_pos + XSVF_HEAP_ALIGN_PAD) & ~((uint32_t) XSVF_HEAP_ALIGN_PAD);
   *pos = heap_pos + size;
   return heap_pos;
 }
@@ -400,7 +513,7 @@ static void xsvf_clear() {
   }
 }
 
-static void xsvf_player_init(jtag_port_t* port) {
+static void xsvf_player_init(jtag_port_t* port, uint8_t lz) {
   jtag_port_init(port);
 
 #ifdef XSVF_HEAP
@@ -408,8 +521,9 @@ static void xsvf_player_init(jtag_port_t* port) {
     // variables allocated on the heap
     uint32_t heap_pos = (uint32_t) XSVF_HEAP;
 
+    uint16_t buf_size;
+
     xsvf = (xsvf_t*) xsvf_heap_pos(&heap_pos, sizeof(xsvf_t));
-    xsvf_buf = (uint8_t*) xsvf_heap_pos(&heap_pos, XSVF_BUF_SIZE);
 
     xsvf_clear();
 
@@ -422,6 +536,24 @@ static void xsvf_player_init(jtag_port_t* port) {
     xsvf_tms_transitions = (uint8_t*) xsvf_heap_pos(&heap_pos, 16);
     xsvf_tms_map = (uint16_t*) xsvf_heap_pos(&heap_pos, 32);
 
+    // the decompression history is used only when there is enough heap for the receive buffer
+    if (lz && heap_pos - ((uint32_t)XSVF_HEAP) + XSVF_LZ_WINDOW + 2 * XSVF_CHUNK_SIZE + XSVF_HEAP_ALIGN_PAD <= sizeof(XSVF_HEAP)) {
+      xsvf_lz_hist = (uint8_t*) xsvf_heap_pos(&heap_pos, XSVF_LZ_WINDOW);
+      xsvf->lz = 1;
+    }
+
+    // the receive buffer takes the rest of the heap: at least 2 chunks (double buffered)
+    buf_size = 2 * XSVF_CHUNK_SIZE;
+    if (heap_pos - ((uint32_t)XSVF_HEAP) + buf_size < sizeof(XSVF_HEAP)) {
+      buf_size = sizeof(XSVF_HEAP) - (heap_pos - ((uint32_t)XSVF_HEAP));
+      if (buf_size > XSVF_BUF_MAX) {
+        buf_size = XSVF_BUF_MAX;
+      }
+      buf_size -= buf_size % XSVF_CHUNK_SIZE;
+    }
+    xsvf->buf_size = buf_size;
+    xsvf_buf = (uint8_t*) xsvf_heap_pos(&heap_pos, buf_size);
+
     if (heap_pos - ((uint32_t)XSVF_HEAP) > sizeof(XSVF_HEAP)) {
       Serial.print(F("Q-1,ERROR: Heap is small:"));
       Serial.println(heap_pos - ((uint32_t)XSVF_HEAP), DEC);
@@ -469,6 +601,8 @@ static void xsvf_player_init(jtag_port_t* port) {
   {
     xsvf_clear();
 
+    xsvf->buf_size = XSVF_BUF_SIZE;
+    xsvf->lz = lz;
     xsvf->xsvf_tdo_mask = xsvf_tdo_mask;
     xsvf->xsvf_tdi = xsvf_tdi;
     xsvf->xsvf_tdo = xsvf_tdo;
@@ -515,6 +649,8 @@ static void xsvf_jtagtap_shift_td(
 			tdo_byte |= tdo << j;
 		}
 		output_data[byte_count - 1 - i] = tdo_byte;
+		// keep the serial RX buffer drained during long shifts
+		xsvf_player_pump();
 	}
 }
 
@@ -551,10 +687,12 @@ static void xsvf_jtagtap_wait_time(jtag_port_t* port, uint32_t microseconds, uin
   if (wait_clock) {
     while (microseconds--) {
       jtag_port_pulse_clock(port);
+      xsvf_player_pump();
     }
   }
   while (micros() < until) {
     jtag_port_pulse_clock(port);
+    xsvf_player_pump();
   }
 }
 
@@ -928,12 +1066,12 @@ static uint8_t xsvf_player_handle_next_instruction(jtag_port_t* port) {
 }
 
 
-static void jtag_play_xsvf(jtag_port_t* port)
+static void jtag_play_xsvf(jtag_port_t* port, uint8_t lz)
 {
   uint32_t n = 0;
   uint8_t ret;
 
-  xsvf_player_init(port);
+  xsvf_player_init(port, lz);
 
   //check xref is high
   if (!jtag_port_get_veref(port)) {
@@ -941,7 +1079,8 @@ static void jtag_play_xsvf(jtag_port_t* port)
     return;
   }
 
-  Serial.println(F("RXSVF")); //announce ready to receive XSVF stream
+  //announce ready to receive XSVF stream, 'Z' : compressed stream is expected
+  Serial.println(xsvf->lz ? F("RXSVFZ") : F("RXSVF"));
 
   while(1) {
     n++;
@@ -973,7 +1112,7 @@ static void jtag_play_xsvf(jtag_port_t* port)
   }
   Serial.print(xsvf->csum, HEX);
   Serial.print(F("/"));
-  Serial.println(xsvf->rdpos, DEC);
+  Serial.println(xsvf->outpos, DEC);
 #endif /* XSVF_CALC_CSUM */
 
   if (xsvf->xcomplete) {
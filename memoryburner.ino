@@ -99,6 +99,10 @@
 // AVR, or UNO R4
 //A0: VPP sense
 //A3: DIGI_POT CS
+// pseudo pins of the pin access plan
+#define PIN_SHR      0xFE
+#define PIN_NONE     0xFF
+
 #define PIN_SHR_EN   A1
 #define PIN_SHR_CS   A2
 //clk and dat is shared SPI bus
@@ -131,6 +135,23 @@
 #define COMMAND_CALIBRATE_VPP 'b'
 #define COMMAND_CALIBRATION_OFFSET 'B'
 #define COMMAND_JTAG_PLAYER 'j'
+#define COMMAND_SET_SPEED 'n'
+#define COMMAND_BLANK_CHECK 'k'
+#define COMMAND_JOB 'x'
+#define COMMAND_POWER_SESSION 'o'
+
+// serial speeds: index 0 is the default speed, then 250k, 500k, 1M, 2M
+#define SERIAL_SPEED_DEFAULT 57600
+#define SERIAL_SPEED_MAX_INDEX 4
+#define SERIAL_SPEED(I) ((I) == 0 ? SERIAL_SPEED_DEFAULT : (250000UL << ((I) - 1)))
+// revert to the default speed when no command is received for this time (ms)
+#define SERIAL_SPEED_IDLE_TIME 10000
+// the power session ends when no command is received for this time (ms)
+#define POWER_SESSION_TIME 3000
+// serial read timeout (ms) while the new speed is probed
+#define SERIAL_SPEED_PROBE_TIME 250
+// time (ms) given to the PC to switch its speed before the prompt is sent
+#define SERIAL_SPEED_SWITCH_TIME 20
 
 #define READGAL 0
 #define VERIFYGAL 1
@@ -439,10 +460,55 @@ galinfo_t galinfo __attribute__ ((section (".noinit"))); //preserve data between
 #define USE_SPARSE_FUSEMAP
 #endif
 
+// packed buffer for one fuse row: (171 bits of ATF750C + 7) / 8 = 22 bytes
+#define ROW_BUF_SIZE 22
+
+// fuse-map streaming modes of readGalFuseMap()
+#define STREAM_NONE 0
+#define STREAM_SEND 1
+#define STREAM_VERIFY 2
+#define STREAM_BLANK 3
+// returned by the streamed verify when the transfer of the expected rows failed
+#define STREAM_VERIFY_FAILED 0xFFFF
+
+// verify mismatch map: bit per fuse row (84 rows of ATF750C), bit per row bit (171 bits) and a flag byte
+#define VERIFY_MAP_SIZE (11 + ROW_BUF_SIZE + 1)
+#define VERIFY_MAP_UES 1
+#define VERIFY_MAP_CFG 2
+
+// returned by the blank check when all fuses read as erased
+#define BLANK_CHECK_OK 0xFFFF
+
+// adaptive programming and erase: the pulse is a fraction of progtime or erasetime,
+// the default cap of pulses gives twice the time. The row pulse count is logged as a hex digit.
+#define ADAPTIVE_PULSE_DIV 4
+#define ADAPTIVE_PULSE_CAP 8
+#define ADAPTIVE_PULSE_CAP_MAX 15
+
+// job flags: the requested stages run in this order in one power session
+#define JOB_ERASE 0x01
+#define JOB_WRITE 0x02
+#define JOB_VERIFY 0x04
+#define JOB_SECURE 0x08
+#define JOB_SKIP_BLANK 0x10 //do not erase a blank GAL
+#define JOB_ADAPTIVE 0x20   //erase and program with adaptive pulses
+#define JOB_STAGES 4
+// job stage results
+#define JOB_SKIPPED 0
+#define JOB_OK 1
+#define JOB_FAILED 2
+#define JOB_BLANK 3
+
 
 GALTYPE gal __attribute__ ((section (".noinit"))); //the gal device index pointing to galInfoList, value is preserved between resets
 
 static short erasetime = 100, progtime = 100;
+static uint8_t pulseCap = 0; //max. program pulses per fuse row in adaptive mode, 0: fixed progtime pulse
+static unsigned short pulseTime; //program pulse of the fuse rows read back after each pulse
+static char pulseLog; //log the pulse counts of the fuse rows
+static char pulseFailFast; //stop writing at the first fuse row which did not program
+static uint8_t pulseFailedRows = 0; //fuse rows which did not program within the pulse cap
+static uint8_t pulseFailedRow; //the first fuse row which did not program
 static uint8_t vpp = 0;
 
 char echoEnabled;
@@ -453,21 +519,65 @@ char endOfLine;
 char mapUploaded;
 char isUploading;
 char uploadError;
+unsigned short uploadCheckSum; //running checksum of the uploaded fuse data
+unsigned short uploadCheckEnd; //fuse index where the next upload data may start, 0xFFFF: running checksum not valid
 unsigned char fusemap[MAXFUSES];
+uint8_t verifyMap[VERIFY_MAP_SIZE]; //fuse rows and row bits which failed the verification
 unsigned char flagBits;
 char varVppExists;
 uint8_t lastShiftRegVal = 0;
+uint8_t serialSpeedIndex;
+unsigned long lastCommandTime;
+char powerOn;   //the GAL is powered
+char powerMode; //VPP mode of the powered GAL
+char powerHeld; //the GAL is kept powered between the operations of a job or a power session
+char powerSession; //the GAL is kept powered between the commands
+unsigned short powerSessionTime; //idle time (ms) which ends the power session
+unsigned long powerSessionCommandTime; //time of the last command which keeps the power session active
+
+// access to a GAL signal: port register and bit mask on AVR, pin number elsewhere
+typedef struct {
+  volatile uint8_t* reg;  // AVR port register: output, input for SDOUT
+  uint8_t mask;           // bit mask in the port register or in the shift register
+  uint8_t pin;            // Arduino pin, PIN_SHR (shift register) or PIN_NONE (not wired)
+} pinAccess_t;
+
+// GAL signals of the current pinout - see buildPinPlan()
+typedef struct {
+  pinAccess_t sclk;
+  pinAccess_t sdin;
+  pinAccess_t sdout;
+  pinAccess_t stb;
+  pinAccess_t pv;
+  pinAccess_t row[6];          // RA0-5 wired to Arduino pins, PIN_NONE when on the shift register
+  const uint8_t* rowShiftReg;  // PROGMEM: shift register value of each row, NULL: no shift register
+  pinAccess_t shrClk;          // shift register bus
+  pinAccess_t shrDat;
+  pinAccess_t shrCs;
+} pinPlan_t;
+
+pinPlan_t pinPlan;
 
 static void setFuseBit(unsigned short bitPos);
+static void setFuseByte(unsigned short bitPos, uint8_t v);
+static void writeFuseByte(unsigned short bitPos, uint8_t v);
+static void clearFuseBit(unsigned short bitPos);
 static unsigned short checkSum(unsigned short n);
+static uint8_t getFuseByte(unsigned short bytePos);
 static char checkGalTypeViaPes(void);
 static void turnOff(void);
+static void endPowerSession(void);
+static void buildPinPlan(void);
 static void printFormatedNumberHex2(unsigned char num) ;
+static void printFormatedNumberHex4(unsigned short num) ;
+static void printFrameHeader(unsigned short total);
+static void printVerifyMap(void);
 
 #include "aftb_vpp.h"
 #include "aftb_sparse.h"
 #include "aftb_seram.h"
 #include "aftb_x9c103s.h"
+#include "aftb_frame.h"
 
 // share fusemap buffer with jtag
 #define XSVF_HEAP fusemap
@@ -483,6 +593,30 @@ void printHelp(char full) {
 #ifdef RAM_BIG
     Serial.println(F(" RAM-BIG "));
 #endif
+  // indication for PC software that binary framed upload is supported
+  Serial.println(F(" BIN-UP "));
+  // indication for PC software that delta upload against the resident fuse map is supported
+  Serial.println(F(" DELTA-UP "));
+  // indication for PC software that the fuse map can be read in binary frames
+  Serial.println(F(" BIN-READ "));
+  // indication for PC software that the fuse rows are streamed while the GAL is being read
+  Serial.println(F(" BIN-STREAM "));
+  // indication for PC software that the expected fuse rows can be streamed for verification
+  Serial.println(F(" BIN-VERIFY "));
+  // indication for PC software that the verification can send the mismatch map
+  Serial.println(F(" VERIFY-MAP "));
+  // indication for PC software that the GAL can be checked for being blank
+  Serial.println(F(" BLANK-CHECK "));
+  // indication for PC software that the fuse rows can be programmed with adaptive pulses
+  Serial.println(F(" ADAPTIVE-PROG "));
+  // indication for PC software that the GAL can be erased with adaptive pulses
+  Serial.println(F(" ADAPTIVE-ERASE "));
+  // indication for PC software that the fuse rows can be verified while they are written
+  Serial.println(F(" WRITE-VERIFY "));
+  // indication for PC software that erase, write, verify and secure can run as one job
+  Serial.println(F(" JOB "));
+  // indication for PC software that the GAL can stay powered between the commands
+  Serial.println(F(" POWER-SESSION "));
 
   if (!full) {
     Serial.println(F("type 'h' for help"));
@@ -497,6 +631,9 @@ void printHelp(char full) {
   Serial.println(F("  w - write uploaded fuses"));
   Serial.println(F("  v - verify fuses"));
   Serial.println(F("  c - erase chip"));
+  Serial.println(F("  k - blank check"));
+  Serial.println(F("  x - run job"));
+  Serial.println(F("  o - power session"));
   Serial.println(F("  t - test & set VPP"));
   Serial.println(F("  b - calibrate VPP"));
   Serial.println(F("  m - measure VPP"));
@@ -633,19 +770,53 @@ static void setupGpios(uint8_t pm) {
   }
 }
 
-#define SHR_SET_BIT(X) digitalWrite(PIN_SHR_CLK, 0); \
-                        digitalWrite(PIN_SHR_DAT, (X) ? HIGH : LOW); \
-                        digitalWrite(PIN_SHR_CLK, 1)
-                        
+static void setPinAccess(pinAccess_t* p, uint8_t pin, char input) {
+  p->pin = pin;
+  p->reg = NULL;
+  p->mask = 0;
+#ifdef __AVR__
+  if (pin != PIN_NONE) {
+    uint8_t port = digitalPinToPort(pin);
+    p->reg = input ? portInputRegister(port) : portOutputRegister(port);
+    p->mask = digitalPinToBitMask(pin);
+  }
+#endif
+}
+
+static void setPinAccessShiftReg(pinAccess_t* p, uint8_t mask) {
+  p->pin = PIN_SHR;
+  p->reg = NULL;
+  p->mask = mask;
+}
+
+// sets an Arduino pin resolved by setPinAccess() to high or low
+static inline void writePort(const pinAccess_t* p, char on) {
+#ifdef __AVR__
+  if (on) {
+    *p->reg |= p->mask;
+  } else {
+    *p->reg &= ~p->mask;
+  }
+#else
+  digitalWrite(p->pin, on ? 1:0);
+#endif
+}
+
+// The shift register bus (A4, A5) is not wired to the hardware SPI / USART pins of the
+// supported boards, so the bits are clocked out via the port registers.
+#define SHR_SET_BIT(X) writePort(&pinPlan.shrClk, 0); \
+                        writePort(&pinPlan.shrDat, (X)); \
+                        writePort(&pinPlan.shrClk, 1)
+
 static void setShiftReg(uint8_t val) {
   lastShiftRegVal = val;
   //assume CS is high
 
   //ensure CLK is high (might be set low by other SPI devices)
-  digitalWrite(PIN_SHR_CLK, 1);
-  
+  writePort(&pinPlan.shrClk, 1);
+
   // set CS low
-  digitalWrite(PIN_SHR_CS, 0);
+  writePort(&pinPlan.shrCs, 0);
   SHR_SET_BIT(val & 0b10000000);
   SHR_SET_BIT(val & 0b1000000);
   SHR_SET_BIT(val & 0b100000);
@@ -654,13 +825,14 @@ static void setShiftReg(uint8_t val) {
   SHR_SET_BIT(val & 0b100);
   SHR_SET_BIT(val & 0b10);
   SHR_SET_BIT(val & 0b1);
-  digitalWrite(PIN_SHR_CS, 1);
+  writePort(&pinPlan.shrCs, 1);
 }
 
 // setup the Arduino board
 void setup() {
 // initialize serial:
-  Serial.begin(57600);
+  Serial.begin(SERIAL_SPEED_DEFAULT);
+  serialSpeedIndex = 0;
   isUploading = 0;
   endOfLine = 0;
   echoEnabled = 0;
@@ -710,15 +882,22 @@ void setup() {
       Serial.println(F("I: SeRAM OK"));
     }
   }
+  // galinfo is preserved between resets
+  buildPinPlan();
+
   printHelp(0);
 
   Serial.println(">");
 }
 
-static void sparseSetup(char clearArray){
+// the sparse fuse map is emptied: a fuse map uploaded for the previous type is lost
+static void sparseSetup(void){
   // Note: Sparse fuse map is ignored on MCUs with big SRAM
   if (gal == ATF750C) {
-    sparseInit(clearArray);
+    sparseInit();
+#ifdef USE_SPARSE_FUSEMAP
+    mapUploaded = 0;
+#endif
   } else {
     sparseDisable();
   }
@@ -728,7 +907,8 @@ static void sparseSetup(char clearArray){
 static void copyGalInfo(void) {
   memcpy_P(&galinfo, &galInfoList[gal], sizeof(galinfo_t));
 
-  sparseSetup(0);
+  sparseSetup();
+  buildPinPlan();
 }
 
 // read from serial line and discard the data
@@ -775,7 +955,7 @@ char handleTerminalCommands() {
       c = line[0];  
       if (!isUploading || c != '#') {
         // prevent 2 character commands from being flagged as invalid
-        if (!(c == COMMAND_SET_GAL_TYPE || c == COMMAND_CALIBRATION_OFFSET || c == COMMAND_JTAG_PLAYER)) {
+        if (!(c == COMMAND_SET_GAL_TYPE || c == COMMAND_CALIBRATION_OFFSET || c == COMMAND_JTAG_PLAYER || c == COMMAND_SET_SPEED || c == COMMAND_UPLOAD || c == COMMAND_READ_FUSES || c == COMMAND_WRITE_FUSES || c == COMMAND_VERIFY_FUSES || c == COMMAND_ERASE_GAL || c == COMMAND_ERASE_GAL_ALL || c == COMMAND_JOB || c == COMMAND_POWER_SESSION)) {
           c = COMMAND_UNKNOWN; 
         }
       }
@@ -842,6 +1022,26 @@ unsigned short parse4hex(char i) {
   return v ;
 }
 
+// Parses the adaptive pulse option of the write and erase commands at line position 'i':
+// 'a' with an optional 1 or 2 digit cap of pulses.
+// Returns the cap of pulses or 0 when the option is not present.
+uint8_t parsePulseCap(char i) {
+  uint8_t cap = ADAPTIVE_PULSE_CAP;
+  if (line[i++] != 'a') {
+    return 0;
+  }
+  if (line[i] >= '0' && line[i] <= '9') {
+    cap = line[i] - '0';
+    if (line[i + 1] >= '0' && line[i + 1] <= '9') {
+      cap = cap * 10 + line[i + 1] - '0';
+    }
+    if (cap < 1 || cap > ADAPTIVE_PULSE_CAP_MAX) {
+      cap = ADAPTIVE_PULSE_CAP;
+    }
+  }
+  return cap;
+}
+
 // Parses a line fed by the serial connection.
 // This hnadles a primitive upload protocol that
 // expects a programatic data feed - not suitable
@@ -853,8 +1053,103 @@ unsigned short parse4hex(char i) {
 // t <gal index>: gal type index to the GALTYPEE enum
 // f <fuse index> <row>: row of fuse-map data starting on fuse bit index
 // c <checksum> : checksum of the whole fuse map
+// b : switch to binary frames of fuse-map data (see aftb_frame.h)
+// h : print hashes of the fuse-map blocks (see printFuseHashes)
 // e : end ofthe upload transfer - returns to terminal
 
+// Receives fuse-map data in binary frames until the end frame arrives.
+// Returns 0 on success.
+static char receiveFuseFrames(void) {
+  uint8_t frame[FRAME_MAX_SIZE];
+  uint8_t expectedSeq = 0;
+  unsigned short limit = galinfo.fuses + 1; //includes APD fuse
+  char result = 0;
+
+  Serial.print(F("OK bin "));
+  Serial.print(FRAME_WINDOW, DEC);
+  Serial.print(' ');
+  Serial.println(FRAME_MAX_PAYLOAD, DEC);
+
+  while (1) {
+    uint8_t i, j;
+    unsigned short addr;
+    int8_t len = frameReceiveNext(frame, expectedSeq, FRAME_MAX_PAYLOAD);
+
+    if (len < 0) {
+      return 1;
+    }
+
+    // frame bits replace the fuse-map bits: delta upload keeps the resident fuse map
+    addr = frame[2] | (frame[3] << 8);
+    for (i = 0; i < len; i++) {
+      uint8_t v = frame[FRAME_HEADER_SIZE + i];
+      // whole bytes are written at once, the bits past the APD fuse are handled one by one
+      if (!(addr & 7) && addr + 8 <= limit) {
+        writeFuseByte(addr, v);
+        addr += 8;
+        continue;
+      }
+      for (j = 0; j < 8; j++) {
+        if (v & (1 << j)) {
+          if (addr < limit) {
+            setFuseBit(addr);
+          } else {
+            result = 1;
+          }
+        } else if (addr < limit) {
+          clearFuseBit(addr);
+        }
+        addr++;
+      }
+    }
+    frameReply(FRAME_ACK, expectedSeq);
+    expectedSeq++;
+
+    if (len == 0) {
+      return result;
+    }
+    //any fuse being set is considered as uploaded fuse map
+    mapUploaded = 1;
+  }
+}
+
+// Prints CRC16 hashes of the resident fuse map split into blocks of binary frame payload size.
+// The PC program then uploads only the blocks which differ from the new fuse map.
+// Output: "OK hash <block count> <fuses per block>", then the hashes (4 hex digits) on lines of 16.
+// The hashes cover all the fuses and the APD fuse, bits past the APD fuse are hashed as 0.
+static void printFuseHashes(void) {
+  uint8_t block[FRAME_MAX_PAYLOAD];
+  unsigned short total = galinfo.fuses + 1;
+  unsigned short addr;
+  uint8_t n = 0;
+
+  Serial.print(F("OK hash "));
+  Serial.print((total + FRAME_MAX_PAYLOAD * 8 - 1) / (FRAME_MAX_PAYLOAD * 8), DEC);
+  Serial.print(' ');
+  Serial.println(FRAME_MAX_PAYLOAD * 8, DEC);
+
+  for (addr = 0; addr < total; addr += FRAME_MAX_PAYLOAD * 8) {
+    uint8_t len = FRAME_MAX_PAYLOAD;
+    if (addr + FRAME_MAX_PAYLOAD * 8 > total) {
+      len = (total - addr + 7) >> 3;
+    }
+    memcpy(block, fusemap + (addr >> 3), len);
+    if (addr + len * 8 > total) {
+      block[len - 1] &= (1 << (total & 7)) - 1;
+    }
+    printFormatedNumberHex4(frameCrc16(0xFFFF, block, len));
+    if (++n == 16) {
+      n = 0;
+      Serial.println();
+    } else {
+      Serial.print(' ');
+    }
+  }
+  if (n) {
+    Serial.println();
+  }
+}
+
 void parseUploadLine() {
   switch (line[1]) {
     case 'e': {
@@ -870,6 +1165,10 @@ void parseUploadLine() {
     case 't': {
       short v = line[3] - '0';
       if (v > 0 && v < LAST_GAL_TYPE) {
+        // the pins of the powered GAL are set for its type
+        if (v != gal) {
+          endPowerSession();
+        }
         gal = (GALTYPE) v;
         copyGalInfo();
         Serial.print(F("OK gal set: "));
@@ -883,7 +1182,6 @@ void parseUploadLine() {
     //fusemap data
     case 'f': {
       char i = 8;
-      char j;
       unsigned short addr;
       short v;
       char fiveDigitAddr = (line[7] != ' ') ? 1 : 0;
@@ -891,20 +1189,32 @@ void parseUploadLine() {
       addr = parse45dec(3, fiveDigitAddr);
       i += fiveDigitAddr;
 
+      // the running checksum is valid as long as the rows do not overlap
+      if (addr < uploadCheckEnd) {
+        uploadCheckEnd = 0xFFFF;
+      }
+
       do {
         v = parse2hex(i);
         if (v >= 0) {
-          for (j = 0; j < 8; j++) {
-            // if fuse bit is set -> then change the fusemap
-            if (v & (1 << j)) {
-              setFuseBit(addr);
+          // fuse data arrive in ascending order: set whole bytes
+          setFuseByte(addr, v);
+          // the APD fuse and beyond are not part of the running checksum
+          if (addr < galinfo.fuses) {
+            if (galinfo.fuses - addr < 8) {
+              v &= (1 << (galinfo.fuses - addr)) - 1;
             }
-            addr++;
+            uploadCheckSum += checkSumByte(addr, v);
           }
+          addr += 8;
           i += 2;
         }
       } while (v >= 0);
 
+      if (uploadCheckEnd != 0xFFFF) {
+        uploadCheckEnd = addr;
+      }
+
       //any fuse being set is considered as uploaded fuse map
       mapUploaded = 1;
 
@@ -916,7 +1226,16 @@ void parseUploadLine() {
     case 'c': {
       unsigned short val = parse4hex(3);
       unsigned char apdFuse = (flagBits & FLAG_BIT_APD) ? 1 : 0;
-      unsigned short cs = checkSum(galinfo.fuses + apdFuse);
+      unsigned short cs;
+      // the sparse fuse map may run out of space: its checksum is calculated from the stored fuses
+      if (uploadCheckEnd != 0xFFFF && !sparseFusemapStat) {
+        cs = uploadCheckSum;
+        if (apdFuse && getFuseBit(galinfo.fuses)) {
+          cs += 1 << (galinfo.fuses & 7);
+        }
+      } else {
+        cs = checkSum(galinfo.fuses + apdFuse);
+      }
       if (cs == val) {
         Serial.println(F("OK checksum matches"));
         // Conditioning jed files might not have any fuse set, so as long as
@@ -931,6 +1250,27 @@ void parseUploadLine() {
       }
     } break;
     
+    //hashes of the resident fusemap, the sparse fusemap can not be updated by delta upload
+    case 'h': {
+      if (sparseFusemapStat) {
+        Serial.println(F("ER hash not supported"));
+      } else {
+        printFuseHashes();
+      }
+    } break;
+
+    //binary fusemap data
+    case 'b': {
+      uploadCheckEnd = 0xFFFF; // frames replace the bits, the checksum is calculated from the fuse map
+      if (receiveFuseFrames()) {
+        uploadError = 1;
+        Serial.println();
+        Serial.println(F("ER binary upload failed"));
+      } else {
+        Serial.println(F("OK bin done"));
+      }
+    } break;
+
     // PES
     case 'p': {
       uint8_t i = 0;
@@ -1006,150 +1346,152 @@ static void setVPP(char on) {
 
 }
 
-static void setSTB(char on) {
+// shift register values of RA0-5 for each row, pins wired directly are 0
+#define ROW_BIT(R, B, V) (((R) & (B)) ? (V) : 0)
+#define ROW_SR_16V8(R)  (ROW_BIT(R, 0x4, PIN_ZIF4) | ROW_BIT(R, 0x8, PIN_ZIF5) | ROW_BIT(R, 0x10, PIN_ZIF6) | ROW_BIT(R, 0x20, PIN_ZIF7))
+#define ROW_SR_18V10(R) (ROW_BIT(R, 0x2, PIN_ZIF21) | ROW_BIT(R, 0x4, PIN_ZIF20) | ROW_BIT(R, 0x10, PIN_ZIF4) | ROW_BIT(R, 0x20, PIN_ZIF5))
+#define ROW_SR_22V10(R) (ROW_BIT(R, 0x1, PIN_ZIF4) | ROW_BIT(R, 0x2, PIN_ZIF5) | ROW_BIT(R, 0x4, PIN_ZIF6) | ROW_BIT(R, 0x8, PIN_ZIF7))
+#define ROW_SR_20V8(R)  (ROW_BIT(R, 0x1, PIN_ZIF21) | ROW_BIT(R, 0x4, PIN_ZIF4) | ROW_BIT(R, 0x8, PIN_ZIF5))
+#define ROW_LUT8(F, R) F(R), F(R + 1), F(R + 2), F(R + 3), F(R + 4), F(R + 5), F(R + 6), F(R + 7)
+#define ROW_LUT(F) { ROW_LUT8(F, 0), ROW_LUT8(F, 8), ROW_LUT8(F, 16), ROW_LUT8(F, 24), \
+                     ROW_LUT8(F, 32), ROW_LUT8(F, 40), ROW_LUT8(F, 48), ROW_LUT8(F, 56) }
+
+static const uint8_t rowShiftReg16V8[64] PROGMEM = ROW_LUT(ROW_SR_16V8);
+static const uint8_t rowShiftReg18V10[64] PROGMEM = ROW_LUT(ROW_SR_18V10);
+static const uint8_t rowShiftReg22V10[64] PROGMEM = ROW_LUT(ROW_SR_22V10);
+static const uint8_t rowShiftReg20V8[64] PROGMEM = ROW_LUT(ROW_SR_20V8);
+
+// Resolves the pins of the GAL signals for the current board and pinout, so the bit
+// clocking functions do not need to branch and can write the port registers directly.
+static void buildPinPlan(void) {
+  uint8_t i;
+  const uint8_t* rowPins = NULL;
+  // RA0-5 pins wired directly to Arduino, the rest is on the shift register
+  static const uint8_t rowPins16V8[6]  = {PIN_ZIF22, PIN_ZIF3, PIN_NONE, PIN_NONE, PIN_NONE, PIN_NONE};
+  static const uint8_t rowPins18V10[6] = {PIN_ZIF22, PIN_NONE, PIN_NONE, PIN_ZIF3, PIN_NONE, PIN_NONE};
+  static const uint8_t rowPins22V10[6] = {PIN_NONE, PIN_NONE, PIN_NONE, PIN_NONE, PIN_ZIF8, PIN_ZIF9};
+  static const uint8_t rowPins20V8[6]  = {PIN_NONE, PIN_ZIF3, PIN_NONE, PIN_NONE, PIN_ZIF8, PIN_ZIF9};
+  static const uint8_t rowPinsOld[6]   = {PIN_RA0, PIN_RA1, PIN_RA2, PIN_RA3, PIN_RA4, PIN_RA5};
+
   if (varVppExists) {
     const PINOUT p = galinfo.pinout;
-    uint8_t pin = PIN_ZIF13;
-    if (p == PINOUT_16V8) {
-      pin = PIN_ZIF15;
-    } else
-    if (p == PINOUT_18V10) {
-      pin = PIN_ZIF8;
+    switch (p) {
+    case PINOUT_16V8:
+      setPinAccess(&pinPlan.stb, PIN_ZIF15, 0);
+      setPinAccess(&pinPlan.pv, PIN_ZIF23, 0);
+      setPinAccess(&pinPlan.sdin, PIN_ZIF9, 0);
+      setPinAccess(&pinPlan.sclk, PIN_ZIF8, 0);
+      setPinAccess(&pinPlan.sdout, PIN_ZIF16, 1);
+      rowPins = rowPins16V8;
+      pinPlan.rowShiftReg = rowShiftReg16V8;
+      break;
+    case PINOUT_18V10:
+      setPinAccess(&pinPlan.stb, PIN_ZIF8, 0);
+      setPinAccess(&pinPlan.pv, PIN_ZIF23, 0);
+      setPinAccessShiftReg(&pinPlan.sdin, PIN_ZIF7);
+      setPinAccessShiftReg(&pinPlan.sclk, PIN_ZIF6);
+      setPinAccess(&pinPlan.sdout, PIN_ZIF9, 1);
+      rowPins = rowPins18V10;
+      pinPlan.rowShiftReg = rowShiftReg18V10;
+      break;
+    case PINOUT_22V10:
+    case PINOUT_600:
+      setPinAccess(&pinPlan.stb, PIN_ZIF13, 0);
+      setPinAccess(&pinPlan.pv, p == PINOUT_22V10 ? PIN_ZIF3 : PIN_ZIF23, 0);
+      setPinAccess(&pinPlan.sdin, PIN_ZIF11, 0);
+      setPinAccess(&pinPlan.sclk, PIN_ZIF10, 0);
+      setPinAccess(&pinPlan.sdout, PIN_ZIF14, 1);
+      rowPins = rowPins22V10;
+      pinPlan.rowShiftReg = rowShiftReg22V10;
+      break;
+    default: //PINOUT_20V8
+      setPinAccess(&pinPlan.stb, PIN_ZIF13, 0);
+      setPinAccess(&pinPlan.pv, p == PINOUT_20V8 ? PIN_ZIF22 : PIN_ZIF23, 0);
+      setPinAccess(&pinPlan.sdin, PIN_ZIF11, 0);
+      setPinAccess(&pinPlan.sclk, PIN_ZIF10, 0);
+      setPinAccess(&pinPlan.sdout, p == PINOUT_20V8 ? PIN_ZIF15 : PIN_ZIF16, 1);
+      rowPins = rowPins20V8;
+      pinPlan.rowShiftReg = rowShiftReg20V8;
     }
-    digitalWrite(pin, on ? 1:0);
   } else {
-    digitalWrite(PIN_STROBE, on ? 1:0);
+    setPinAccess(&pinPlan.stb, PIN_STROBE, 0);
+    setPinAccess(&pinPlan.pv, PIN_PV, 0);
+    setPinAccess(&pinPlan.sdin, PIN_SDIN, 0);
+    setPinAccess(&pinPlan.sclk, PIN_SCLK, 0);
+    setPinAccess(&pinPlan.sdout, PIN_SDOUT, 1);
+    rowPins = rowPinsOld;
+    pinPlan.rowShiftReg = NULL;
+  }
+  for (i = 0; i < 6; i++) {
+    setPinAccess(&pinPlan.row[i], rowPins[i], 0);
   }
+  setPinAccess(&pinPlan.shrClk, PIN_SHR_CLK, 0);
+  setPinAccess(&pinPlan.shrDat, PIN_SHR_DAT, 0);
+  setPinAccess(&pinPlan.shrCs, PIN_SHR_CS, 0);
 }
 
-static void setPV(char on) {
-  if (varVppExists) {
-    const PINOUT p = galinfo.pinout;
-    uint8_t pin = PIN_ZIF23;
-
-    if (p == PINOUT_22V10) {
-      pin = PIN_ZIF3;
-    } else
-    if (p == PINOUT_20V8) {
-      pin = PIN_ZIF22;
+// sets the GAL signal to high or low
+static inline void writePin(const pinAccess_t* p, char on) {
+  if (p->pin == PIN_SHR) {
+    uint8_t val = on ? (lastShiftRegVal | p->mask) : (lastShiftRegVal & ~p->mask);
+    // the shift register is reloaded only when its outputs change
+    if (val != lastShiftRegVal) {
+      setShiftReg(val);
     }
-    digitalWrite(pin, on ? 1:0);
-  } else {
-    digitalWrite(PIN_PV, on ? 1:0);
+    return;
   }
+  writePort(p, on);
+}
+
+static void setSTB(char on) {
+  writePin(&pinPlan.stb, on);
+}
+
+static void setPV(char on) {
+  writePin(&pinPlan.pv, on);
 }
 
 static void setSDIN(char on) {
-  if (varVppExists) {
-    const PINOUT p = galinfo.pinout;
-    if (p == PINOUT_18V10) {
-      if (on) {
-        lastShiftRegVal |= PIN_ZIF7;
-      } else {
-        lastShiftRegVal &= ~PIN_ZIF7;
-      }
-      setShiftReg(lastShiftRegVal);
-    } else {
-    const uint8_t pin = (p == PINOUT_16V8) ? PIN_ZIF9 : PIN_ZIF11;
-    digitalWrite(pin, on ? 1:0);
-    }
-  } else {
-    digitalWrite(PIN_SDIN, on ? 1:0);
-  }
+  writePin(&pinPlan.sdin, on);
 }
 
 static void setSCLK(char on){
-  if (varVppExists) {
-    const PINOUT p = galinfo.pinout;
-    if (p == PINOUT_18V10) {
-      if (on) {
-        lastShiftRegVal |= PIN_ZIF6;
-      } else {
-        lastShiftRegVal &= ~PIN_ZIF6;
-      }
-      setShiftReg(lastShiftRegVal);
-    } else {
-    uint8_t pin = (p == PINOUT_16V8) ? PIN_ZIF8 : PIN_ZIF10;
-    digitalWrite(pin, on ? 1:0);
-    }
-  } else {
-    digitalWrite(PIN_SCLK, on ? 1:0);
-  }
+  writePin(&pinPlan.sclk, on);
 }
 
 // output row address (RA0-5)
 static void setRow(char row)
 {
-  if (varVppExists) {
-    uint8_t srval = 0;
-    const PINOUT p = galinfo.pinout;
-    if (p == PINOUT_16V8) {
-      digitalWrite(PIN_ZIF22, (row & 0x1)); //RA0
-      digitalWrite(PIN_ZIF3 , (row & 0x2)); //RA1
-      if (row & 0x4) srval  |= PIN_ZIF4; //RA2
-      if (row & 0x8) srval  |= PIN_ZIF5; //RA3
-      if (row & 0x10) srval |= PIN_ZIF6; //RA4
-      if (row & 0x20) srval |= PIN_ZIF7; //RA5
-    } else 
-    if (p == PINOUT_18V10) {
-      digitalWrite(PIN_ZIF22, (row & 0x1)); //RA0
-      if (row & 0x2) srval  |= PIN_ZIF21; //RA1
-      if (row & 0x4) srval  |= PIN_ZIF20; //RA2
-      digitalWrite(PIN_ZIF3 , (row & 0x8)); //RA3
-      if (row & 0x10) srval  |= PIN_ZIF4; //RA4
-      if (row & 0x20) srval  |= PIN_ZIF5; //RA5
-    } else
-    if (p == PINOUT_22V10 || p == PINOUT_600) {
-      if (row & 0x1) srval  |= PIN_ZIF4; //RA0
-      if (row & 0x2) srval  |= PIN_ZIF5; //RA1
-      if (row & 0x4) srval  |= PIN_ZIF6; //RA2
-      if (row & 0x8) srval  |= PIN_ZIF7; //RA3
-      digitalWrite(PIN_ZIF8, (row & 0x10)); //RA4
-      digitalWrite(PIN_ZIF9, (row & 0x20)); //RA5
-    } else { //PINOUT_20V8
-      if (row & 0x1) srval  |= PIN_ZIF21; //RA0
-      digitalWrite(PIN_ZIF3 , (row & 0x2)); //RA1
-      if (row & 0x4) srval  |= PIN_ZIF4; //RA2
-      if (row & 0x8) srval  |= PIN_ZIF5; //RA3
-      digitalWrite(PIN_ZIF8, (row & 0x10)); //RA4
-      digitalWrite(PIN_ZIF9, (row & 0x20)); //RA5           
-    }
-    setShiftReg(srval);
-  } else {
-    digitalWrite(PIN_RA0, (row & 0x1));
-    digitalWrite(PIN_RA1, ((row & 0x2) ? 1:0));
-    digitalWrite(PIN_RA2, ((row & 0x4) ? 1:0));
-    digitalWrite(PIN_RA3, ((row & 0x8) ? 1:0));
-    digitalWrite(PIN_RA4, ((row & 0x10) ? 1:0));
-    digitalWrite(PIN_RA5, ((row & 0x20) ? 1:0));
+  uint8_t i;
+  for (i = 0; i < 6; i++) {
+    if (pinPlan.row[i].pin != PIN_NONE) {
+      writePin(&pinPlan.row[i], row & (1 << i));
+    }
+  }
+  if (pinPlan.rowShiftReg) {
+    setShiftReg(pgm_read_byte(&pinPlan.rowShiftReg[row & 0x3F]));
   }
 }
 
 // serial data out form the GAL chip -> received by Arduino
 static char getSDOUT(void)
 {
-  if (varVppExists) {
-    const PINOUT p = galinfo.pinout;
-    uint8_t pin = PIN_ZIF16;
-    
-    if (p == PINOUT_22V10 || p == PINOUT_600) {
-      pin = PIN_ZIF14;
-    } else
-    if (p == PINOUT_20V8) {
-      pin = PIN_ZIF15;
-    } else
-    if (p == PINOUT_18V10) {
-      pin = PIN_ZIF9;
-    }
-    return digitalRead(pin) != 0;
-  } else {
-    return digitalRead(PIN_SDOUT) != 0;
-  }
+#ifdef __AVR__
+  return (*pinPlan.sdout.reg & pinPlan.sdout.mask) != 0;
+#else
+  return digitalRead(pinPlan.sdout.pin) != 0;
+#endif
 }
 
 // GAL finish sequence
 static void turnOff(void)
 {
+    // the job or the power session turns the GAL off when it ends
+    if (powerHeld) {
+        setPV(0);
+        return;
+    }
+    powerOn = 0;
     delay(100);
     setPV(0);    // P/V- low
     setRow(0x3F);// RA0-5 high  
@@ -1184,6 +1526,23 @@ static void turnOn(char mode) {
         mode = 0;
     }
 
+    // the GAL is kept powered: switch the VPP level and reset the control lines
+    if (powerHeld && powerOn) {
+        if (mode != powerMode) {
+            setVPP(mode);
+            powerMode = mode;
+            delay(20);
+        }
+        setPV(0);
+        setRow(0x3F);
+        setSDIN(1);
+        setSTB(1);
+        setSCLK(0);
+        return;
+    }
+    powerOn = 1;
+    powerMode = mode;
+
 //     setVPP(mode);
     setVPP(0);    // VPP off
     setPV(0);     // P/V- low
@@ -1209,6 +1568,27 @@ static char receiveBit(void)
     return b;
 }
 
+// receive 'n' bits from GAL into a packed row buffer (LSb first)
+static void receiveFuseRow(unsigned char* rowBuf, unsigned char n)
+{
+    unsigned char val = 0;
+    unsigned char mask = 1;
+    while (n-- > 0) {
+      if (receiveBit()) {
+        val |= mask;
+      }
+      mask <<= 1;
+      if (!mask) {
+        *rowBuf++ = val;
+        val = 0;
+        mask = 1;
+      }
+    }
+    if (mask != 1) {
+      *rowBuf = val;
+    }
+}
+
 // read n number of bits
 static void discardBits(short n)
 {
@@ -1240,6 +1620,21 @@ static void sendBits(short n, char bitValue)
     }
 }
 
+// send 'n' bits of a packed row buffer (LSb first) to GAL
+static void sendFuseRow(const unsigned char* rowBuf, unsigned char n, char skipLastClk)
+{
+    unsigned char val = 0;
+    unsigned char mask = 0;
+    while (n-- > 0) {
+      if (!mask) {
+        val = *rowBuf++;
+        mask = 1;
+      }
+      sendBit((val & mask) ? 1 : 0, n == 0 ? skipLastClk : 0);
+      mask <<= 1;
+    }
+}
+
 // send row address bits to SDIN 
 // ATF22V10C MSb first, other 22V10 LSb first
 static void sendAddress(unsigned char n, unsigned char row)
@@ -1593,13 +1988,44 @@ void printPes(char type) {
 // sets a fuse bit on particular position
 // expects that the fusemap was cleared (set to zero) beforehand
 static void setFuseBit(unsigned short bitPos) {
-    uint16_t pos;
     if (sparseFusemapStat) {
-      pos = sparseSetFuseBit(bitPos);
+      sparseSetFuseBit(bitPos);
     } else {
-      pos = bitPos >> 3; //divide the bit position by 8 to get the byte position
+      fusemap[bitPos >> 3] |= (1 << (bitPos & 7)); //divide the bit position by 8 to get the byte position
+    }
+}
+
+// sets 8 fuse bits starting at particular position, bit 0 of 'v' goes to 'bitPos'
+// expects that the fusemap was cleared (set to zero) beforehand
+static void setFuseByte(unsigned short bitPos, uint8_t v) {
+    if (sparseFusemapStat) {
+      sparseSetFuseByte(bitPos, v);
+    } else {
+      uint8_t shift = bitPos & 7;
+      bitPos >>= 3;
+      fusemap[bitPos] |= v << shift;
+      if (shift && (v >> (8 - shift))) {
+        fusemap[bitPos + 1] |= v >> (8 - shift);
+      }
+    }
+}
+
+// replaces 8 fuse bits at a byte aligned position
+// the sparse fusemap does not support clearing: only the set bits are written
+static void writeFuseByte(unsigned short bitPos, uint8_t v) {
+    if (sparseFusemapStat) {
+      sparseSetFuseByte(bitPos, v);
+    } else {
+      fusemap[bitPos >> 3] = v;
+    }
+}
+
+// clears a fuse bit on particular position
+// the sparse fusemap does not support clearing: it must be cleared beforehand
+static void clearFuseBit(unsigned short bitPos) {
+    if (!sparseFusemapStat) {
+      fusemap[bitPos >> 3] &= ~(1 << (bitPos & 7));
     }
-    fusemap[pos] |= (1 << (bitPos & 7));
 }
 
 // gets a fuse bit from specific fuse position
@@ -1616,17 +2042,149 @@ static char getFuseBit(unsigned short bitPos) {
   return (fusemap[pos] & (1 << (bitPos & 7))) ? 1 : 0;
 }
 
+// extracts 'count' fuse bits that are 'stride' bits apart, starting at 'bitPos',
+// into a packed row buffer (LSb first). Used for shifting whole rows to the GAL.
+static void getFuseRow(unsigned char* rowBuf, unsigned short bitPos, unsigned short stride, unsigned char count) {
+  unsigned char outVal = 0;
+  unsigned char outMask = 1;
+
+  if (sparseFusemapStat) {
+    while (count--) {
+      if (getFuseBit(bitPos)) {
+        outVal |= outMask;
+      }
+      bitPos += stride;
+      outMask <<= 1;
+      if (!outMask) {
+        *rowBuf++ = outVal;
+        outVal = 0;
+        outMask = 1;
+      }
+    }
+  } else {
+    // walk the packed fusemap with a byte pointer and a bit mask instead of
+    // calculating the byte and bit position of each fuse
+    const unsigned char* src = &fusemap[bitPos >> 3];
+    const unsigned short strideBytes = stride >> 3;
+    const unsigned char strideBits = stride & 7;
+    unsigned char srcMask = 1 << (bitPos & 7);
+
+    while (count--) {
+      if (*src & srcMask) {
+        outVal |= outMask;
+      }
+      uint16_t m = (uint16_t) srcMask << strideBits;
+      if (m > 0xFF) {
+        src++;
+        m >>= 8;
+      }
+      srcMask = m;
+      src += strideBytes;
+      outMask <<= 1;
+      if (!outMask) {
+        *rowBuf++ = outVal;
+        outVal = 0;
+        outMask = 1;
+      }
+    }
+  }
+  if (outMask != 1) {
+    *rowBuf = outVal;
+  }
+}
+
+// gets 8 fuse bits from a byte position
+static uint8_t getFuseByte(unsigned short bytePos) {
+  if (sparseFusemapStat) {
+    return sparseGetFuseByte(bytePos);
+  }
+  return fusemap[bytePos];
+}
+
 static void setFuseBitVal(unsigned short bitPos, char val) {
   if (val) {
     setFuseBit(bitPos);
   }
 }
 
+// stores a fuse bit read from the GAL: into the fusemap array or, when streaming,
+// into the packed buffer of the fuses that follow the fuse rows (UES, CFG and APD)
+static void storeReadFuseBit(unsigned char* tailBuf, unsigned short addr) {
+  if (tailBuf) {
+    addr -= galinfo.rows * galinfo.bits;
+    tailBuf[addr >> 3] |= 1 << (addr & 7);
+  } else {
+    setFuseBit(addr);
+  }
+}
+
+// The verify mismatch map records the fuse rows and the row bits (product terms) which failed the verification:
+// [row bits: (rows + 7) / 8 bytes] [row bit positions: (bits + 7) / 8 bytes] [VERIFY_MAP_* flags]
+static uint8_t verifyMapSize(void) {
+  return ((galinfo.rows + 7) >> 3) + ((galinfo.bits + 7) >> 3) + 1;
+}
+
+static void verifyMapBit(unsigned short bit) {
+  bit += (galinfo.rows + 7) & ~7;
+  verifyMap[bit >> 3] |= 1 << (bit & 7);
+}
+
+static void verifyMapMark(unsigned short row, unsigned short bit) {
+  verifyMap[row >> 3] |= 1 << (row & 7);
+  verifyMapBit(bit);
+}
+
+static void verifyMapFlag(uint8_t flag) {
+  verifyMap[verifyMapSize() - 1] |= flag;
+}
+
+// receives the frame with the expected fuses of the streamed verify and counts
+// the 'bits' which differ from the 'actual' fuses read from the GAL.
+// The differing bits are stored in the 'actual' buffer.
+static unsigned short verifyStreamedFrame(uint8_t* frame, uint8_t seq, uint16_t addr, unsigned char* actual, unsigned short bits) {
+  unsigned short errors = 0;
+  uint8_t i;
+  int8_t len = frameReceiveNext(frame, seq, FRAME_ROW_PAYLOAD);
+
+  if (len < 0 || (unsigned short) len * 8 < bits || (frame[2] | (frame[3] << 8)) != addr) {
+    return STREAM_VERIFY_FAILED;
+  }
+  for (i = 0; bits > 0; i++) {
+    uint8_t diff = actual[i] ^ frame[FRAME_HEADER_SIZE + i];
+    if (bits < 8) {
+      diff &= (1 << bits) - 1;
+      bits = 0;
+    } else {
+      bits -= 8;
+    }
+    actual[i] = diff;
+    while (diff) {
+      diff &= diff - 1;
+      errors++;
+    }
+  }
+  frameReply(FRAME_ACK, seq);
+  return errors;
+}
+
 // generic fuse-map reading, fuse-map bits are stored in fusemap array
-static void readGalFuseMap(const unsigned char* cfgArray, char useDelay, char doDiscardBits) {
+// STREAM_SEND: each fuse row is sent in a binary frame as soon as it is read (see aftb_frame.h),
+// the fusemap array is not used. The serial TX buffer sends the row while the next one is read.
+// STREAM_VERIFY: each fuse row is compared with the expected row received in a binary frame,
+// the fusemap array is not used. Returns the number of bit errors or STREAM_VERIFY_FAILED.
+// STREAM_BLANK: stops at the first fuse which reads as 0 (the fuses of an erased GAL read as 1),
+// the fusemap array is not used. Returns the row holding the programmed fuse or BLANK_CHECK_OK.
+static unsigned short readGalFuseMap(const unsigned char* cfgArray, char useDelay, char doDiscardBits, char stream) {
   unsigned short cfgAddr = galinfo.cfgbase;
   unsigned short row, bit;
   unsigned short addr;
+  unsigned char rowBuf[ROW_BUF_SIZE];
+  unsigned char* tailBuf = NULL;
+  const unsigned short tailBase = galinfo.rows * galinfo.bits;
+  uint8_t frame[FRAME_ROW_SIZE];
+  unsigned short errors = 0;
+  uint8_t apdFuse = 0;
+  uint8_t seq = 0;
 
   if (flagBits & FLAG_BIT_ATF16V8C) {
       setPV(0);
@@ -1638,13 +2196,38 @@ static void readGalFuseMap(const unsigned char* cfgArray, char useDelay, char do
         setSDIN(0);
         setPV(1);
     }
-    for(bit = 0; bit < galinfo.bits; bit++) {
-      // check the received bit is 1 and if so then set the fuse map
-      if (receiveBit()) {
-        addr = galinfo.rows;
-        addr *= bit;
-        addr += row;
-        setFuseBit(addr);
+    if (stream == STREAM_VERIFY) {
+      receiveFuseRow(rowBuf, galinfo.bits);
+      addr = verifyStreamedFrame(frame, seq++, FRAME_ADDR_ROW | row, rowBuf, galinfo.bits);
+      if (addr == STREAM_VERIFY_FAILED) {
+        return STREAM_VERIFY_FAILED;
+      }
+      if (addr) {
+        errors += addr;
+        for (bit = 0; bit < galinfo.bits; bit++) {
+          if (rowBuf[bit >> 3] & (1 << (bit & 7))) {
+            verifyMapMark(row, bit);
+          }
+        }
+      }
+    } else if (stream == STREAM_BLANK) {
+      for(bit = 0; bit < galinfo.bits; bit++) {
+        if (!receiveBit()) {
+          return row;
+        }
+      }
+    } else if (stream) {
+      receiveFuseRow(rowBuf, galinfo.bits);
+      frameSend(seq++, FRAME_ADDR_ROW | row, rowBuf, (galinfo.bits + 7) >> 3);
+    } else {
+      for(bit = 0; bit < galinfo.bits; bit++) {
+        // check the received bit is 1 and if so then set the fuse map
+        if (receiveBit()) {
+          addr = galinfo.rows;
+          addr *= bit;
+          addr += row;
+          setFuseBit(addr);
+        }
       }
     }
     if (useDelay) {
@@ -1655,6 +2238,12 @@ static void readGalFuseMap(const unsigned char* cfgArray, char useDelay, char do
     }
   }
 
+  // UES, CFG and APD fuses are sent in one frame at the end, the blank check drops them
+  if (stream) {
+    memset(rowBuf, 0, ROW_BUF_SIZE);
+    tailBuf = rowBuf;
+  }
+
   // read UES
   strobeRow(galinfo.uesrow);
   if (flagBits & FLAG_BIT_ATF16V8C) {
@@ -1669,7 +2258,9 @@ static void readGalFuseMap(const unsigned char* cfgArray, char useDelay, char do
     if (receiveBit()) {
       addr = galinfo.uesfuse;
       addr += bit;
-      setFuseBit(addr);
+      storeReadFuseBit(tailBuf, addr);
+    } else if (stream == STREAM_BLANK) {
+      return galinfo.uesrow;
     }
   }
   if (useDelay) {
@@ -1693,7 +2284,9 @@ if (galinfo.cfgmethod == CFG_STROBE_ROW2) { //ATF750C
           break;
         if (receiveBit()) {
           unsigned char cfgOffset = pgm_read_byte(&cfgArray[absBit]);
-          setFuseBit(cfgAddr + cfgOffset);
+          storeReadFuseBit(tailBuf, cfgAddr + cfgOffset);
+        } else if (stream == STREAM_BLANK) {
+          return cfgstroberow + i;
         }
       }
       if (useDelay) {
@@ -1715,11 +2308,18 @@ if (galinfo.cfgmethod == CFG_STROBE_ROW2) { //ATF750C
     for(bit = 0; bit < galinfo.cfgbits; bit++) {
       if (receiveBit()) {
         unsigned char cfgOffset = pgm_read_byte(&cfgArray[bit]); //read array byte flom flash
-        setFuseBit(cfgAddr + cfgOffset);
+        storeReadFuseBit(tailBuf, cfgAddr + cfgOffset);
+      } else if (stream == STREAM_BLANK) {
+        return galinfo.cfgrow;
       }
     }
   }
 
+  // the APD fuse is not part of the blank check
+  if (stream == STREAM_BLANK) {
+    return BLANK_CHECK_OK;
+  }
+
   //check APD fuse bit - only for ATF16V8C or ATF22V10C
   if ((flagBits & FLAG_BIT_ATF16V8C) || gal == ATF22V10C) {
     setPV(0);
@@ -1732,7 +2332,38 @@ if (galinfo.cfgmethod == CFG_STROBE_ROW2) { //ATF750C
       strobe(1);
       setPV(1);
     }
-    setFlagBit(FLAG_BIT_APD, receiveBit());
+    // the streamed verify compares the APD fuse with the expected one
+    if (stream == STREAM_VERIFY) {
+      apdFuse = 1;
+      if (receiveBit()) {
+        storeReadFuseBit(tailBuf, galinfo.fuses);
+      }
+    } else {
+      setFlagBit(FLAG_BIT_APD, receiveBit());
+    }
+  }
+
+  if (stream == STREAM_VERIFY) {
+    // UES, CFG and the APD fuse slot follow the rows, then the end frame
+    addr = verifyStreamedFrame(frame, seq++, tailBase, rowBuf, galinfo.fuses - tailBase + apdFuse);
+    if (addr == STREAM_VERIFY_FAILED || verifyStreamedFrame(frame, seq, galinfo.fuses + 1, rowBuf, 0) == STREAM_VERIFY_FAILED) {
+      return STREAM_VERIFY_FAILED;
+    }
+    errors += addr;
+    for (addr = tailBase; addr < galinfo.fuses + apdFuse; addr++) {
+      bit = addr - tailBase;
+      if (rowBuf[bit >> 3] & (1 << (bit & 7))) {
+        verifyMapFlag((addr >= galinfo.uesfuse && addr < galinfo.uesfuse + 8 * galinfo.uesbytes) ? VERIFY_MAP_UES : VERIFY_MAP_CFG);
+      }
+    }
+  } else if (stream) {
+    // the APD fuse follows the last fuse, the end frame carries the total fuse count
+    addr = galinfo.fuses;
+    if (flagBits & FLAG_BIT_APD) {
+      storeReadFuseBit(tailBuf, addr++);
+    }
+    frameSend(seq++, tailBase, tailBuf, (addr - tailBase + 7) >> 3);
+    frameSend(seq, addr, tailBuf, 0);
   }
 
 #if 0
@@ -1740,6 +2371,7 @@ if (galinfo.cfgmethod == CFG_STROBE_ROW2) { //ATF750C
     sparsePrintStat();
   }
 #endif
+  return errors;
 }
 
 static void readGalFuseMap600(const unsigned char* cfgArray) {
@@ -1787,7 +2419,8 @@ static void readGalFuseMap600(const unsigned char* cfgArray) {
 }
 
 // generic fuse-map verification, fuse map bits are compared against read bits
-static unsigned short verifyGalFuseMap(const unsigned char* cfgArray, char useDelay, char doDiscardBits) {
+// 'skipRows' verifies UES and CFG only
+static unsigned short verifyGalFuseMap(const unsigned char* cfgArray, char useDelay, char doDiscardBits, char skipRows = 0) {
   unsigned short cfgAddr = galinfo.cfgbase;
   unsigned short row, bit;
   unsigned short addr;
@@ -1805,7 +2438,7 @@ static unsigned short verifyGalFuseMap(const unsigned char* cfgArray, char useDe
   }
 
   // read fuse rows
-  for(row = 0; row < galinfo.rows; row++) {
+  for(row = skipRows ? galinfo.rows : 0; row < galinfo.rows; row++) {
     strobeRow(row);
     if (flagBits & FLAG_BIT_ATF16V8C) {
         setSDIN(0);
@@ -1823,6 +2456,7 @@ static unsigned short verifyGalFuseMap(const unsigned char* cfgArray, char useDe
         Serial.print(addr, DEC);
 #endif
         errors++;
+        verifyMapMark(row, bit);
       }
     }
     if (useDelay) {
@@ -1853,6 +2487,7 @@ static unsigned short verifyGalFuseMap(const unsigned char* cfgArray, char useDe
       Serial.println(bit, DEC);
 #endif
       errors++;
+      verifyMapFlag(VERIFY_MAP_UES);
     }
   }
   if (useDelay) {
@@ -1882,6 +2517,7 @@ static unsigned short verifyGalFuseMap(const unsigned char* cfgArray, char useDe
         Serial.println(absBit, DEC);
   #endif
           errors++;
+          verifyMapFlag(VERIFY_MAP_CFG);
         }
       }
       if (useDelay) {
@@ -1909,6 +2545,7 @@ static unsigned short verifyGalFuseMap(const unsigned char* cfgArray, char useDe
         Serial.println(bit, DEC);
   #endif
         errors++;
+        verifyMapFlag(VERIFY_MAP_CFG);
       }
     }
   }
@@ -1933,6 +2570,7 @@ static unsigned short verifyGalFuseMap(const unsigned char* cfgArray, char useDe
       Serial.println(F("C pd"));
 #endif
       errors++;
+      verifyMapFlag(VERIFY_MAP_CFG);
     }
   }
 
@@ -1960,6 +2598,7 @@ static unsigned short verifyGalFuseMap600(const unsigned char* cfgArray) {
             Serial.println(7296 + 78 * bit + row, DEC);
 #endif
             errors++;
+            verifyMapMark(row, bit);
           }
       }
       for (bit = 0; bit < 64; bit++) {
@@ -1971,6 +2610,7 @@ static unsigned short verifyGalFuseMap600(const unsigned char* cfgArray) {
             Serial.println(114 * bit + row, DEC);
 #endif
             errors++;
+            verifyMapMark(row, 11 + bit);
           }
       }
       discardBits(24);
@@ -1992,6 +2632,7 @@ static unsigned short verifyGalFuseMap600(const unsigned char* cfgArray) {
             Serial.println(78 + 114 * row + bit, DEC);
 #endif
             errors++;
+            verifyMapBit(11 + row);
           }
       }
       discardBits(83);
@@ -2004,6 +2645,7 @@ static unsigned short verifyGalFuseMap600(const unsigned char* cfgArray) {
             Serial.println(98 + 114 * row + bit, DEC);
 #endif
             errors++;
+            verifyMapBit(11 + row);
           }
       }
   }
@@ -2020,6 +2662,7 @@ static unsigned short verifyGalFuseMap600(const unsigned char* cfgArray) {
         Serial.println(addr + bit, DEC);
 #endif
         errors++;
+        verifyMapFlag(VERIFY_MAP_UES);
       }
   }
   // CFG
@@ -2036,6 +2679,7 @@ static unsigned short verifyGalFuseMap600(const unsigned char* cfgArray) {
         Serial.println(addr + cfgOffset, DEC);
 #endif
         errors++;
+        verifyMapFlag(VERIFY_MAP_CFG);
       }
   }
   
@@ -2045,21 +2689,40 @@ static unsigned short verifyGalFuseMap600(const unsigned char* cfgArray) {
 // main fuse-map reading and verification function
 // READING: reads fuse rows, UES, CFG from GAL and stores into fusemap bit array RAM.
 // VERIFY:  reads fuse rows, UES, CFG from GAL and compares with fusemap bit array in RAM.
-static void readOrVerifyGal(char verify)
+// STREAM_SEND:   reads fuse rows, UES, CFG from GAL and sends them in binary frames, fusemap is kept.
+// STREAM_VERIFY: reads fuse rows, UES, CFG from GAL and compares them with the rows received
+//                in binary frames, fusemap is kept.
+// Streaming is not supported on GAL6001/6002.
+// 'printMap' sends the verify mismatch map when the verification fails.
+// Returns 1 when the verification failed.
+static char readOrVerifyGal(char verify, char stream = STREAM_NONE, char printMap = 0)
 {
   unsigned short i;
   unsigned char* cfgArray = (unsigned char*) cfgV8;
 
   //ensure fusemap is cleared before READ operation, keep it for VERIFY operation.
-  if (!verify) {
+  if (!verify && !stream) {
     for (i = 0; i < MAXFUSES; i++) {
       fusemap[i] = 0;
     }
-    sparseSetup(1);
+    sparseSetup();
+  }
+  if (verify) {
+    memset(verifyMap, 0, VERIFY_MAP_SIZE);
   }
 
   turnOn(READGAL);
 
+  // the PC software sends the expected rows after the GAL is powered up
+  if (stream == STREAM_VERIFY) {
+    Serial.print(F("OK bin verify "));
+    Serial.print(FRAME_ROW_WINDOW, DEC);
+    Serial.print(' ');
+    Serial.println(FRAME_ROW_PAYLOAD, DEC);
+  } else if (stream) {
+    printFrameHeader(galinfo.fuses);
+  }
+
   switch(gal)
   {
     case GAL16V8:
@@ -2068,10 +2731,10 @@ static void readOrVerifyGal(char verify)
           cfgArray = (unsigned char*) cfgV8AB;
         }
         //read without delay, no discard
-        if (verify) {
+        if (verify && !stream) {
           i = verifyGalFuseMap(cfgArray, 0, 0);
         } else {
-          readGalFuseMap(cfgArray, 0, 0);
+          i = readGalFuseMap(cfgArray, 0, 0, stream);
         }
         break;
       
@@ -2084,10 +2747,10 @@ static void readOrVerifyGal(char verify)
     case GAL26CV12:
         cfgArray = (unsigned char*) galinfo.cfg;
         //read without delay, no discard
-        if (verify) {
+        if (verify && !stream) {
           i = verifyGalFuseMap(cfgArray, 0, 0);
         } else {
-          readGalFuseMap(cfgArray, 0, 0);
+          i = readGalFuseMap(cfgArray, 0, 0, stream);
         }
         break;
 
@@ -2106,56 +2769,158 @@ static void readOrVerifyGal(char verify)
     case ATF22V10B:
     case ATF22V10C:
       //read with delay 1 ms, discard 68 cfg bits on ATFxx
-      if (verify) {
+      if (verify && !stream) {
         i = verifyGalFuseMap(cfgV10, 1, (gal == GAL22V10) ? 0 : 68);
       } else {
-        readGalFuseMap(cfgV10, 1, (gal == GAL22V10) ? 0 : 68);
+        i = readGalFuseMap(cfgV10, 1, (gal == GAL22V10) ? 0 : 68, stream);
       } 
       break;
     case ATF750C:
       //read with delay 1 ms, discard 107 bits on ATF750C
-      if (verify) {
+      if (verify && !stream) {
         i = verifyGalFuseMap(galinfo.cfg, 1, galinfo.bits - 8 * galinfo.uesbytes - 1);
       } else {
-        readGalFuseMap(galinfo.cfg, 1, galinfo.bits - 8 * galinfo.uesbytes - 1);
+        i = readGalFuseMap(galinfo.cfg, 1, galinfo.bits - 8 * galinfo.uesbytes - 1, stream);
       }
   }
   turnOff();
 
-  if (verify && i > 0) {
+  if (stream == STREAM_VERIFY && i == STREAM_VERIFY_FAILED) {
+    readGarbage();
+    Serial.println();
+    Serial.println(F("ER binary verify failed"));
+    return 1;
+  } else if (verify && i > 0) {
+    if (printMap) {
+      printVerifyMap();
+    }
     Serial.print(F("ER verify failed. Bit errors: "));
     Serial.println(i, DEC);
+    return 1;
+  }
+  return 0;
+}
+
+// blank check of the powered GAL, returns the first programmed row or BLANK_CHECK_OK
+// Not supported on GAL6001/6002.
+static unsigned short readGalBlank(void)
+{
+  switch(gal)
+  {
+    case GAL22V10:
+    case ATF22V10B:
+    case ATF22V10C:
+      //read with delay 1 ms, discard 68 cfg bits on ATFxx
+      return readGalFuseMap(cfgV10, 1, (gal == GAL22V10) ? 0 : 68, STREAM_BLANK);
+    case ATF750C:
+      //read with delay 1 ms, discard 107 bits on ATF750C
+      return readGalFuseMap(galinfo.cfg, 1, galinfo.bits - 8 * galinfo.uesbytes - 1, STREAM_BLANK);
+    default:
+      //read without delay, no discard, the read CFG bits are not kept
+      return readGalFuseMap(galinfo.cfg, 0, 0, STREAM_BLANK);
+  }
+}
+
+// checks the GAL is blank, the fusemap is not used
+static void blankCheckGal(void)
+{
+  unsigned short row;
+
+  turnOn(READGAL);
+  row = readGalBlank();
+  turnOff();
+
+  if (row == BLANK_CHECK_OK) {
+    Serial.println(F("OK blank"));
+  } else {
+    Serial.print(F("ER not blank. Programmed row: "));
+    Serial.println(row, DEC);
   }
 }
 
+// adaptive programming of a fuse row which was already shifted in and addressed.
+// pulseTime pulses are repeated until the row reads back as expected or pulseCap is reached.
+// The read-back clocks the row out: the row is shifted in again before the next pulse.
+// V8: P/V is kept high between the rows. V10: P/V is raised for the pulse only.
+// The pulse count is logged, 'x' marks the rows which did not program.
+// Returns 0 if the row did not program.
+static char programFuseRowAdaptive(const unsigned char* rowBuf, unsigned char row, unsigned char bits, char isV8) {
+  unsigned char readBuf[ROW_BUF_SIZE];
+  uint8_t pulses = 0;
+
+  for (;;) {
+    if (!isV8) {
+      setPV(1);
+    }
+    strobe(pulseTime);
+    setPV(0);
+    pulses++;
+
+    // read the row back
+    strobeRow(row);
+    receiveFuseRow(readBuf, bits);
+    if (memcmp(readBuf, rowBuf, (bits + 7) >> 3) == 0) {
+      if (pulseLog) {
+        Serial.print(pulses, HEX);
+      }
+      break;
+    }
+    if (pulses >= pulseCap) {
+      if (pulseLog) {
+        Serial.print('x');
+      }
+      if (!pulseFailedRows++) {
+        pulseFailedRow = row;
+      }
+      pulses = 0;
+      break;
+    }
+
+    // shift the row in again
+    if (isV8) {
+      setPV(1);
+      setRow(row);
+      sendFuseRow(rowBuf, bits, 0);
+    } else {
+      setRow(0);
+      sendFuseRow(rowBuf, bits, 0);
+      sendAddress(6, row);
+    }
+  }
+  if (isV8) {
+    setPV(1);
+  }
+  return pulses;
+}
+
 // fuse-map writing function for V8 GAL chips
 static void writeGalFuseMapV8(const unsigned char* cfgArray) {
   unsigned short cfgAddr = galinfo.cfgbase;
   unsigned char row, rbit;
-  unsigned short addr;
   unsigned char rbitMax = galinfo.bits;
+  unsigned char rowBuf[ROW_BUF_SIZE];
   const unsigned char skipLastClk = (flagBits & FLAG_BIT_ATF16V8C) ? 1 : 0;
 
   setPV(1);
   // write fuse rows
   for (row = 0; row < galinfo.rows; row++) {
     setRow(row);
-    for(rbit = 0; rbit < rbitMax; rbit++) {
-      addr = galinfo.rows;
-      addr *= rbit;
-      addr += row;
-      sendBit(getFuseBit(addr), rbit == rbitMax - 1 ? skipLastClk : 0);
+    getFuseRow(rowBuf, row, galinfo.rows, rbitMax);
+    sendFuseRow(rowBuf, rbitMax, skipLastClk);
+    if (pulseCap) {
+      if (!programFuseRowAdaptive(rowBuf, row, rbitMax, 1) && pulseFailFast) {
+        setPV(0);
+        return;
+      }
+    } else {
+      strobe(progtime);
     }
-    strobe(progtime);
   }
 
   // write UES
   setRow(galinfo.uesrow);
-  for (rbit = 0; rbit < 64; rbit++) {
-    addr = galinfo.uesfuse;
-    addr += rbit;
-    sendBit(getFuseBit(addr), rbit == 63 ? skipLastClk : 0);
-  }
+  getFuseRow(rowBuf, galinfo.uesfuse, 1, 64);
+  sendFuseRow(rowBuf, 64, skipLastClk);
   strobe(progtime);
 
   // write CFG (all ICs use setRow)
@@ -2180,33 +2945,32 @@ static void writeGalFuseMapV8(const unsigned char* cfgArray) {
 static void writeGalFuseMapV10(const unsigned char* cfgArray, char fillUesStart, char useSdin) {
   unsigned short cfgAddr = galinfo.cfgbase;
   unsigned char row, bit;
-  unsigned short addr;
+  unsigned char rowBuf[ROW_BUF_SIZE];
   unsigned short uesFill = galinfo.bits - galinfo.uesbytes * 8;
 
   setRow(0); //RA0-5 low
   // write fuse rows
   for (row = 0; row < galinfo.rows; row++) {
-    for (bit = 0; bit < galinfo.bits; bit++) {
-      addr = galinfo.rows;
-      addr *= bit;
-      addr += row;
-      sendBit(getFuseBit(addr));
-    }
+    getFuseRow(rowBuf, row, galinfo.rows, galinfo.bits);
+    sendFuseRow(rowBuf, galinfo.bits, 0);
     sendAddress(6, row);
-    setPV(1);
-    strobe(progtime);
-    setPV(0);
+    if (pulseCap) {
+      if (!programFuseRowAdaptive(rowBuf, row, galinfo.bits, 0) && pulseFailFast) {
+        return;
+      }
+    } else {
+      setPV(1);
+      strobe(progtime);
+      setPV(0);
+    }
   }
 
   // write UES
   if (fillUesStart) {
     sendBits(uesFill, 1);
   }
-  for (bit = 0; bit < galinfo.uesbytes * 8; bit++) {
-    addr = galinfo.uesfuse;
-    addr += bit;
-    sendBit(getFuseBit(addr));
-  }
+  getFuseRow(rowBuf, galinfo.uesfuse, 1, galinfo.uesbytes * 8);
+  sendFuseRow(rowBuf, galinfo.uesbytes * 8, 0);
   if (!fillUesStart) {
     sendBits(uesFill, 1);
   }
@@ -2244,6 +3008,7 @@ static void writeGalFuseMapV750(const unsigned char* cfgArray) {
   unsigned short cfgAddr = galinfo.cfgbase;
   unsigned char row, bit;
   unsigned short addr;
+  unsigned char rowBuf[ROW_BUF_SIZE];
   unsigned short uesFill = galinfo.bits - (galinfo.uesbytes * 8) - 1;
   uint8_t cfgRowLen = 10; //ATF750C
   uint8_t cfgStrobeRow = 96; //ATF750C
@@ -2252,12 +3017,8 @@ static void writeGalFuseMapV750(const unsigned char* cfgArray) {
   setRow(0); //RA0-5 low
   delayMicroseconds(20);
   for(row = 0; row < galinfo.rows; row++) {
-    for (bit = 0; bit < galinfo.bits; bit++) {
-      addr = galinfo.rows;
-      addr *= bit;
-      addr += row;
-      sendBit(getFuseBit(addr));
-    }
+    getFuseRow(rowBuf, row, galinfo.rows, galinfo.bits);
+    sendFuseRow(rowBuf, galinfo.bits, 0);
 
     sendAddress(7, row);
     setPV(1);
@@ -2273,11 +3034,8 @@ static void writeGalFuseMapV750(const unsigned char* cfgArray) {
   sendBits(uesFill, 0); //send X number of 0 bits between fuse rows and UES data
 
   //write UES
-  for (bit = 0; bit < (8 * galinfo.uesbytes); bit++) {
-    addr = galinfo.uesfuse;
-    addr += bit;
-    sendBit(getFuseBit(addr));
-  }
+  getFuseRow(rowBuf, galinfo.uesfuse, 1, 8 * galinfo.uesbytes);
+  sendFuseRow(rowBuf, 8 * galinfo.uesbytes, 0);
 
   //set 1 bit after UES to 0
   sendBits(1, 0);
@@ -2391,11 +3149,41 @@ static void writeGalFuseMap600(const unsigned char* cfgArray) {
 }
 
 // main fuse-map writing function
-static void writeGal()
+// 'cap' > 0 programs the fuse rows with adaptive pulses (V8 and V10 GAL chips except ATF16V8C),
+// UES and CFG rows are always programmed with the progtime pulse.
+// 'verify' reads each fuse row back right after its progtime pulse (or adaptive pulses) and stops
+// at the first row which did not program. UES and CFG are verified before the GAL is turned off.
+// The GAL chips which can not read back the rows are verified after the write.
+// Returns 1 when the write or the verification failed.
+static char writeGal(uint8_t cap = 0, char verify = 0)
 {
-  unsigned short i;
+  unsigned short i = 0;
   unsigned char* cfgArray = (unsigned char*) cfgV8;
 
+  // ATF16V8C leaves the clock high after the last bit, its rows can not be read back between the pulses
+  if ((cap || verify) && (gal == GAL6001 || gal == GAL6002 || gal == ATF750C || (flagBits & FLAG_BIT_ATF16V8C))) {
+    writeGal();
+    return verify ? readOrVerifyGal(1) : 0;
+  }
+  pulseLog = cap ? 1 : 0;
+  pulseFailFast = verify;
+  pulseTime = progtime;
+  if (cap) {
+    pulseTime /= ADAPTIVE_PULSE_DIV;
+    if (!pulseTime) {
+      pulseTime = 1;
+    }
+  } else if (verify) {
+    cap = 1;
+  }
+  pulseCap = cap;
+  pulseFailedRows = 0;
+  if (pulseLog) {
+    Serial.print(F("OK pulses: "));
+  }
+  if (verify) {
+    memset(verifyMap, 0, VERIFY_MAP_SIZE);
+  }
 
   turnOn(WRITEGAL);
 
@@ -2411,7 +3199,8 @@ static void writeGal()
       
     case ATF16V8B:
     case ATF20V8B:
-        writeGalFuseMapV8(cfgV8AB); 
+        cfgArray = (unsigned char*) cfgV8AB;
+        writeGalFuseMapV8(cfgArray);
         break;
 
     case GAL6001:
@@ -2432,27 +3221,93 @@ static void writeGal()
     case GAL22V10:
     case ATF22V10B:
     case ATF22V10C:
-        writeGalFuseMapV10(cfgV10, (gal == GAL22V10) ? 0 : 1, (gal == ATF22V10C) ? 1 : 0);
+        cfgArray = (unsigned char*) cfgV10;
+        writeGalFuseMapV10(cfgArray, (gal == GAL22V10) ? 0 : 1, (gal == ATF22V10C) ? 1 : 0);
         break;
     case ATF750C:
         writeGalFuseMapV750(cfgV750);
   }
+
+  // the fuse rows were verified while written, verify UES and CFG
+  if (verify && !pulseFailedRows) {
+    if (cfgArray == cfgV10) {
+      //read with delay 1 ms, discard 68 cfg bits on ATFxx
+      i = verifyGalFuseMap(cfgArray, 1, (gal == GAL22V10) ? 0 : 68, 1);
+    } else {
+      //read without delay, no discard
+      i = verifyGalFuseMap(cfgArray, 0, 0, 1);
+    }
+  }
   turnOff();
+
+  if (pulseLog) {
+    Serial.println();
+  }
+  if (pulseFailedRows) {
+    if (verify) {
+      Serial.print(F("ER verify failed. Row: "));
+      Serial.println(pulseFailedRow, DEC);
+    } else {
+      Serial.print(F("ER write failed. Rows not programmed: "));
+      Serial.println(pulseFailedRows, DEC);
+    }
+  } else if (i > 0) {
+    Serial.print(F("ER verify failed. Bit errors: "));
+    Serial.println(i, DEC);
+  }
+  pulseCap = 0;
+  return (pulseFailedRows || i) ? 1 : 0;
 }
 
 // erases fuse-map in the GAL
-static void eraseGAL(char eraseAll)
+// 'cap' > 0 erases with short pulses: the GAL is blank checked after each pulse
+// and the pulse is repeated until the GAL is blank or 'cap' pulses were applied.
+// Returns 1 when the GAL did not erase.
+static char eraseGAL(char eraseAll, uint8_t cap = 0)
 {
-    turnOn(ERASEGAL);
-    
-    setPV(1);
-    setRow(eraseAll ? galinfo.eraseallrow : galinfo.eraserow);
-    if (gal == GAL16V8 || gal == ATF16V8B || gal==GAL20V8) {
-        sendBit(1);
+    unsigned short pulse = erasetime;
+    unsigned short row = BLANK_CHECK_OK;
+    uint8_t pulses = 0;
+
+    // the blank check is not supported on GAL6001/6002
+    if (gal == GAL6001 || gal == GAL6002) {
+        cap = 0;
     }
-    strobe(erasetime);
-    setPV(0);
+    if (cap) {
+        pulse = erasetime / ADAPTIVE_PULSE_DIV;
+        if (!pulse) {
+            pulse = 1;
+        }
+    }
+
+    turnOn(ERASEGAL);
+
+    do {
+        setPV(1);
+        setRow(eraseAll ? galinfo.eraseallrow : galinfo.eraserow);
+        if (gal == GAL16V8 || gal == ATF16V8B || gal==GAL20V8) {
+            sendBit(1);
+        }
+        strobe(pulse);
+        setPV(0);
+        pulses++;
+        if (cap) {
+            row = readGalBlank();
+        }
+    } while (row != BLANK_CHECK_OK && pulses < cap);
+
     turnOff();
+
+    if (cap) {
+        if (row == BLANK_CHECK_OK) {
+            Serial.print(F("OK erase pulses: "));
+            Serial.println(pulses, DEC);
+        } else {
+            Serial.print(F("ER erase failed. Programmed row: "));
+            Serial.println(row, DEC);
+        }
+    }
+    return (row != BLANK_CHECK_OK) ? 1 : 0;
 }
 
 // sets security bit - disables fuse reading
@@ -2591,26 +3446,26 @@ static unsigned char addFormatedNumberDec4(unsigned short num, unsigned char i)
 }
 
 // calculates fuse-map checksum and returns it
+// the checksum is a 16 bit sum of the fuse-map bytes, the last byte holds the remaining fuses
 static unsigned short checkSum(unsigned short n)
 {
-    unsigned short c, e, i;
-    unsigned long a;
-
-    c = e= 0;
-    a = 0;
-    for (i = 0; i < n; i++) {
-        e++;
-        if (e == 9) {
-          e = 1;
-          a += c;
-          c = 0;
-        }
-        c >>= 1;
-        if (getFuseBit(i)) {
-          c += 0x80;
-        }
+    unsigned short a = 0;
+    unsigned short i;
+
+    for (i = 0; i < (n >> 3); i++) {
+        a += getFuseByte(i);
+    }
+    if (n & 7) {
+        a += getFuseByte(i) & ((1 << (n & 7)) - 1);
     }
-    return (unsigned short)((c >> (8 - e)) + a);
+    return a;
+}
+
+// JEDEC checksum contribution of 8 fuse bits starting at a fuse position
+static unsigned short checkSumByte(unsigned short bitPos, uint8_t v)
+{
+    unsigned short w = v << (bitPos & 7);
+    return (w & 0xFF) + (w >> 8);
 }
 
 static void printGalName() {
@@ -2783,6 +3638,66 @@ static void printJedec()
     Serial.println('*');
 }
 
+// Output: "OK bin read <fuse count> <PES bytes in hex> <GAL name>", the binary frames follow.
+static void printFrameHeader(unsigned short total)
+{
+    uint8_t i;
+
+    Serial.print(F("OK bin read "));
+    Serial.print(total, DEC);
+    Serial.print(' ');
+    for (i = 0; i < galinfo.pesbytes; i++) {
+      printFormatedNumberHex2(pes[i]);
+    }
+    Serial.print(' ');
+    printGalName();
+}
+
+// Sends the fuse map in binary frames (see aftb_frame.h), the PC software renders the JEDEC file.
+// The frame header line is followed by the frames of fuse-map bytes. The last frame has no payload.
+static void printFuseFrames(void)
+{
+    uint8_t payload[FRAME_READ_PAYLOAD];
+    uint8_t apdFuse = (flagBits & FLAG_BIT_APD) ? 1 : 0;
+    unsigned short total = galinfo.fuses + apdFuse;
+    unsigned short addr;
+    uint8_t seq = 0;
+    uint8_t i;
+
+    if (apdFuse) {
+      setFuseBit(galinfo.fuses); // the APD fuse is printed as set
+    }
+
+    printFrameHeader(total);
+
+    for (addr = 0; addr < total; addr += FRAME_READ_PAYLOAD * 8) {
+      uint8_t len = FRAME_READ_PAYLOAD;
+      if (addr + FRAME_READ_PAYLOAD * 8 > total) {
+        len = (total - addr + 7) >> 3;
+      }
+      for (i = 0; i < len; i++) {
+        payload[i] = getFuseByte((addr >> 3) + i);
+      }
+      // bits past the last fuse are sent as 0
+      if (addr + len * 8 > total) {
+        payload[len - 1] &= (1 << (total & 7)) - 1;
+      }
+      frameSend(seq++, addr, payload, len);
+    }
+    frameSend(seq, total, payload, 0);
+}
+
+// Sends the verify mismatch map in one binary frame (see verifyMapSize).
+// Output: "OK bin map <fuse rows> <row bits>", then the frame.
+static void printVerifyMap(void)
+{
+    Serial.print(F("OK bin map "));
+    Serial.print(galinfo.rows, DEC);
+    Serial.print(' ');
+    Serial.println(galinfo.bits, DEC);
+    frameSend(0, 0, verifyMap, verifyMapSize());
+}
+
 // helper print function to save RAM space
 static void printNoFusesError() {
   Serial.println(F("ER fuse map not uploaded"));
@@ -2840,6 +3755,141 @@ static char doTypeCheck(void) {
   return testProperGAL();
 }
 
+// ends the power session: the GAL is turned off
+static void endPowerSession(void) {
+  if (powerSession) {
+    powerSession = 0;
+    powerHeld = 0;
+    turnOff();
+  }
+}
+
+// starts or ends the power session: the GAL stays powered and the pins stay configured between
+// the commands. VPP is at the safe level between the commands, turnOn() restores it. The session ends after 'seconds' without
+// a GAL command ('*' and 'h' do not count), when a command not working with the GAL is received or when the GAL type changes.
+// 'o' starts the session with the default idle time, 'o<1-9>' with 1-9 seconds, 'o0' ends it.
+static void setPowerSession(int8_t seconds) {
+  if (seconds == 0) {
+    endPowerSession();
+    Serial.println(F("OK session off"));
+    return;
+  }
+  powerSessionTime = (seconds > 0 && seconds <= 9) ? seconds * 1000 : POWER_SESSION_TIME;
+  powerSession = 1;
+  powerHeld = 1;
+  Serial.print(F("OK session "));
+  Serial.println(powerSessionTime, DEC);
+}
+
+// returns 1 for the commands which keep the power session
+static char isPowerSessionCommand(char command) {
+  switch (command) {
+    case COMMAND_IDENTIFY_PROGRAMMER:
+    case COMMAND_HELP:
+    case COMMAND_ECHO:
+    case COMMAND_UPLOAD:
+    case COMMAND_UTX:
+    case COMMAND_READ_PES:
+    case COMMAND_READ_FUSES:
+    case COMMAND_WRITE_FUSES:
+    case COMMAND_VERIFY_FUSES:
+    case COMMAND_ERASE_GAL:
+    case COMMAND_ERASE_GAL_ALL:
+    case COMMAND_BLANK_CHECK:
+    case COMMAND_JOB:
+    case COMMAND_ENABLE_SECURITY:
+    case COMMAND_ENABLE_APD:
+    case COMMAND_DISABLE_APD:
+    case COMMAND_ENABLE_CHECK_TYPE:
+    case COMMAND_DISABLE_CHECK_TYPE:
+    case COMMAND_SET_SPEED:
+    case COMMAND_POWER_SESSION:
+      return 1;
+  }
+  return 0;
+}
+
+static void printJobStage(const __FlashStringHelper* name, uint8_t result, unsigned short time) {
+  Serial.print(' ');
+  Serial.print(name);
+  switch (result) {
+    case JOB_OK: Serial.print(F(":ok:")); break;
+    case JOB_FAILED: Serial.print(F(":fail:")); break;
+    case JOB_BLANK: Serial.print(F(":blank:")); break;
+    default: Serial.print(F(":skip:"));
+  }
+  Serial.print(time, DEC);
+}
+
+// runs the erase, write, verify and secure stages requested by the JOB_* flags on the resident
+// fuse map. The GAL stays powered until all stages are finished, the stages after a failed one
+// are skipped. The job ends with one result record: the status and the time (ms) of each stage.
+// OK job erase:ok:105 write:ok:612 verify:ok:243 secure:skip:0
+static void runJob(uint8_t flags) {
+  const uint8_t cap = (flags & JOB_ADAPTIVE) ? ADAPTIVE_PULSE_CAP : 0;
+  uint8_t result[JOB_STAGES];
+  unsigned short time[JOB_STAGES];
+  unsigned long start;
+  char failed = 0;
+  uint8_t i;
+
+  if ((flags & (JOB_WRITE | JOB_VERIFY)) && !mapUploaded) {
+    printNoFusesError();
+    return;
+  }
+  if (!doTypeCheck()) {
+    return;
+  }
+
+  // keep the GAL powered, the power session may hold it already
+  powerHeld = 1;
+  for (i = 0; i < JOB_STAGES; i++) {
+    result[i] = JOB_SKIPPED;
+    time[i] = 0;
+    if (failed || !(flags & (1 << i))) {
+      continue;
+    }
+    start = millis();
+    switch (1 << i) {
+      case JOB_ERASE:
+        // the blank check is not supported on GAL6001/6002
+        if ((flags & JOB_SKIP_BLANK) && gal != GAL6001 && gal != GAL6002) {
+          turnOn(READGAL);
+          if (readGalBlank() == BLANK_CHECK_OK) {
+            result[i] = JOB_BLANK;
+          }
+          turnOff();
+        }
+        if (result[i] != JOB_BLANK) {
+          failed = eraseGAL(0, cap);
+        }
+        break;
+      case JOB_WRITE:
+        failed = writeGal(cap);
+        break;
+      case JOB_VERIFY:
+        failed = readOrVerifyGal(1);
+        break;
+      case JOB_SECURE:
+        secureGAL();
+        break;
+    }
+    time[i] = millis() - start;
+    if (result[i] != JOB_BLANK) {
+      result[i] = failed ? JOB_FAILED : JOB_OK;
+    }
+  }
+  powerHeld = powerSession;
+  turnOff();
+
+  Serial.print(failed ? F("ER job") : F("OK job"));
+  printJobStage(F("erase"), result[0], time[0]);
+  printJobStage(F("write"), result[1], time[1]);
+  printJobStage(F("verify"), result[2], time[2]);
+  printJobStage(F("secure"), result[3], time[3]);
+  Serial.println();
+}
+
 static void measureVpp(uint8_t index) {
   varVppSet(index);
   delay(150);
@@ -2901,7 +3951,7 @@ static void calibrateVpp(void) {
   }
 }
 
-static void startJtagPlayer(uint8_t vpp) {
+static void startJtagPlayer(uint8_t vpp, uint8_t lz) {
   jtag_port_t jport;
   //assign jtag pins
   jport.tms = 12;
@@ -2920,7 +3970,7 @@ static void startJtagPlayer(uint8_t vpp) {
   }
 
   // start XSVF player / processor
-  jtag_play_xsvf(&jport);
+  jtag_play_xsvf(&jport, lz);
 
   // unset VPP
   if (varVppExists) {
@@ -2928,6 +3978,43 @@ static void startJtagPlayer(uint8_t vpp) {
   }
 }
 
+// Checks the link works on the new serial speed: the PC sends a probe frame which
+// is echoed back, then the PC confirms it received the echo intact.
+static char probeSerialSpeed(void) {
+  uint8_t frame[FRAME_MAX_SIZE];
+  char result = 0;
+
+  Serial.setTimeout(SERIAL_SPEED_PROBE_TIME);
+  if (frameReceive(frame, FRAME_MAX_PAYLOAD) == FRAME_MAX_PAYLOAD) {
+    Serial.write(frame, FRAME_MAX_SIZE);
+    result = (Serial.readBytes(frame, 2) == 2 && frame[0] == FRAME_ACK);
+  }
+  Serial.setTimeout(1000); //default timeout
+  return result;
+}
+
+// Switches the serial speed. Reverts to the default speed when the probe fails.
+static void setSerialSpeed(uint8_t index) {
+  if (index > SERIAL_SPEED_MAX_INDEX) {
+    Serial.println(F("ER unsupported speed"));
+    return;
+  }
+  Serial.print(F("OK speed "));
+  Serial.println(SERIAL_SPEED(index), DEC);
+  Serial.flush(); //ensure the reply is sent out with the old speed
+  Serial.begin(SERIAL_SPEED(index));
+  serialSpeedIndex = index;
+
+  if (index && !probeSerialSpeed()) {
+    Serial.begin(SERIAL_SPEED_DEFAULT);
+    serialSpeedIndex = 0;
+    readGarbage();
+    Serial.println(F("ER speed probe failed"));
+  } else if (!index) {
+    delay(SERIAL_SPEED_SWITCH_TIME);
+  }
+}
+
 // Arduino main loop
 void loop() {
 
@@ -2942,6 +4029,11 @@ void loop() {
       lineIndex = 0;
     }
 
+    // the commands which do not work with the GAL end the power session
+    if (powerSession && command != COMMAND_NONE && !isPowerSessionCommand(command)) {
+      endPowerSession();
+    }
+
     // handle commands received from the serial terminal
     switch (command) {
       
@@ -2955,10 +4047,20 @@ void loop() {
       } break;
 
       // verify fuse-map bits and bits read from the GAL chip
+      // 'vs' verifies the fuse rows streamed by the PC software, the fuse map is not needed
+      // 'vm' and 'vsm' send the mismatch map when the verification fails
       case COMMAND_VERIFY_FUSES: {
-        if (mapUploaded) {
+        char stream = (line[1] == 's') ? 1 : 0;
+        char printMap = (line[1 + stream] == 'm') ? 1 : 0;
+        if (stream) {
+          if (gal == GAL6001 || gal == GAL6002) {
+            Serial.println(F("ER binary verify not supported"));
+          } else if (doTypeCheck()) {
+            readOrVerifyGal(1, STREAM_VERIFY, printMap);
+          }
+        } else if (mapUploaded) {
           if (doTypeCheck()) {
-            readOrVerifyGal(1); //just verify, do not overwrite fusemap
+            readOrVerifyGal(1, STREAM_NONE, printMap); //just verify, do not overwrite fusemap
           }
         } else {
           printNoFusesError();
@@ -2966,13 +4068,20 @@ void loop() {
       } break;
 
       // handle upload command - start the download of fuse-map
+      // 'uk' keeps the resident fuse map for delta upload
       case COMMAND_UPLOAD: {
         short i;
         // clean fuses
-        for (i = 0; i < MAXFUSES; i++) {
-          fusemap[i] = 0;
+        if (line[1] != 'k') {
+          for (i = 0; i < MAXFUSES; i++) {
+            fusemap[i] = 0;
+          }
+          sparseSetup();
+          uploadCheckEnd = 0;
+        } else {
+          uploadCheckEnd = 0xFFFF; // the fuse map is kept: the running checksum is not known
         }
-        sparseSetup(1);
+        uploadCheckSum = 0;
         isUploading = 1;
         uploadError = 0;
       } break;
@@ -2999,10 +4108,20 @@ void loop() {
       } break;
 
       // read fuse-map from the GAL and print it in the JEDEC form
+      // 'rb' sends the fuse-map in binary frames
+      // 'rs' streams the fuse rows in binary frames while reading
       case COMMAND_READ_FUSES : {
         if (doTypeCheck()) {
-          readOrVerifyGal(0); //just read, no verification
-          printJedec();
+          if (line[1] == 's' && gal != GAL6001 && gal != GAL6002) {
+            readOrVerifyGal(0, STREAM_SEND);
+          } else {
+            readOrVerifyGal(0); //just read, no verification
+            if (line[1] == 'b' || line[1] == 's') {
+              printFuseFrames();
+            } else {
+              printJedec();
+            }
+          }
         }
       } break;
 
@@ -3010,7 +4129,10 @@ void loop() {
       case COMMAND_WRITE_FUSES : {
         if (mapUploaded) {
           if (doTypeCheck()) {
-            writeGal();
+            // 'wa' programs with adaptive pulses, 'wa<N>' sets the cap of pulses per row
+            // 'wv' and 'wva<N>' verify each fuse row right after it is programmed
+            char verify = (line[1] == 'v') ? 1 : 0;
+            writeGal(parsePulseCap(1 + verify), verify);
             //security is handled by COMMAND_ENABLE_SECURITY command
           }
         } else {
@@ -3019,18 +4141,39 @@ void loop() {
       } break;
 
       // erases the fuse-map on the GAL chip
+      // 'ca' and '~a' erase with adaptive pulses, 'ca<N>' and '~a<N>' set the cap of pulses
       case COMMAND_ERASE_GAL: {
         if (doTypeCheck()) {
-          eraseGAL(0);
+          eraseGAL(0, parsePulseCap(1));
         }
       } break;
       // erases PES and the fuse-map on the GAL chip
       case COMMAND_ERASE_GAL_ALL: {
         if (doTypeCheck()) {
-          eraseGAL(1);
+          eraseGAL(1, parsePulseCap(1));
+        }
+      } break;
+
+      // checks the fuse-map on the GAL chip is erased
+      case COMMAND_BLANK_CHECK: {
+        if (gal == GAL6001 || gal == GAL6002) {
+          Serial.println(F("ER blank check not supported"));
+        } else if (doTypeCheck()) {
+          blankCheckGal();
         }
       } break;
 
+      // keeps the GAL powered between the commands
+      case COMMAND_POWER_SESSION: {
+        setPowerSession(line[1] == '\r' ? -1 : line[1] - '0');
+      } break;
+
+      // runs the erase, write, verify and secure stages in one power session
+      // 'x<flags>': flags are 2 hex digits of JOB_* bits
+      case COMMAND_JOB: {
+        runJob(parse2hex(1));
+      } break;
+
       // sets the security bit
       case COMMAND_ENABLE_SECURITY: {
         if (doTypeCheck()) {
@@ -3105,11 +4248,16 @@ void loop() {
       } break;
 
       case COMMAND_JTAG_PLAYER: {
-        startJtagPlayer(line[1] == '1');
+        // j<vpp>[z] : 'z' the XSVF stream is compressed
+        startJtagPlayer(line[1] == '1', line[2] == 'z');
         //flush the serial line in case the player ended abruptly
         readGarbage();
       } break;
 
+      case COMMAND_SET_SPEED: {
+        setSerialSpeed(line[1] - '0');
+      } break;
+
       default: {
         if (command != COMMAND_NONE) {
           Serial.print(F("ER Unknown command: "));
@@ -3118,10 +4266,32 @@ void loop() {
       }
     }
 
+    // the GAL stays powered between the commands of the power session, VPP is set to
+    // the safe level until the next turnOn()
+    if (powerSession && powerOn && powerMode) {
+      setVPP(0);
+      powerMode = 0;
+    }
+
     // display prompt character - important for the PC program to check that Arduino
     // finished the desired operation
     if (command != COMMAND_NONE) {
       Serial.println(F(">"));
+      lastCommandTime = millis();
+      // the keep-alive pings of the PC program do not extend the power session
+      if (command != COMMAND_IDENTIFY_PROGRAMMER && command != COMMAND_HELP) {
+        powerSessionCommandTime = lastCommandTime;
+      }
+    } else
+    // the PC program is gone without restoring the serial speed: use the default speed
+    if (serialSpeedIndex && millis() - lastCommandTime > SERIAL_SPEED_IDLE_TIME) {
+      Serial.begin(SERIAL_SPEED_DEFAULT);
+      serialSpeedIndex = 0;
+    }
+
+    // the PC program is gone or idle: turn the GAL off
+    if (powerSession && millis() - powerSessionCommandTime > powerSessionTime) {
+      endPowerSession();
     }
 
     // and that's it!
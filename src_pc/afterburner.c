@@ -45,9 +45,17 @@ To compile: gcc -g3 -O0 -o afterburner afterburner.c
 #include <string.h>
 #include <errno.h>
 #include <stdint.h>
+#include <time.h>
 
 #include "serial_port.h"
 
+#ifndef _USE_WIN_API_
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
+
 #define VERSION "v.0.6.0"
 
 #ifdef GCOM
@@ -58,11 +66,54 @@ To compile: gcc -g3 -O0 -o afterburner afterburner.c
 
 #define MAX_LINE (16*1024)
 
+// serial receive ring buffer size, must be a power of 2
+#define SERIAL_RX_SIZE 4096
+#define SERIAL_RX_MASK (SERIAL_RX_SIZE - 1)
+
 #define MAXFUSES 30000
 #define GALBUFSIZE (256 * 1024)
 
 #define JTAG_ID 0xFF
 
+// binary upload frames: [len] [seq] [addr lo] [addr hi] [payload] [crc lo] [crc hi]
+#define FRAME_HEADER_SIZE 4
+#define FRAME_CRC_SIZE 2
+#define FRAME_MAX_PAYLOAD 16
+#define FRAME_MAX_SIZE (FRAME_HEADER_SIZE + FRAME_MAX_PAYLOAD + FRAME_CRC_SIZE)
+// fuse-map read-back frames sent by the programmer are bigger and not acknowledged
+#define FRAME_READ_PAYLOAD 64
+#define FRAME_ADDR_ROW 0x8000
+#define FRAME_ROW_PAYLOAD 22
+#define FRAME_ROW_SIZE (FRAME_HEADER_SIZE + FRAME_ROW_PAYLOAD + FRAME_CRC_SIZE)
+#define FRAME_ACK 0x06
+#define FRAME_NAK 0x15
+#define FRAME_RETRIES 8
+
+// job flags: erase, write, verify and secure run in one power session of the programmer
+#define JOB_ERASE 0x01
+#define JOB_WRITE 0x02
+#define JOB_VERIFY 0x04
+#define JOB_SECURE 0x08
+#define JOB_SKIP_BLANK 0x10
+
+// serial speeds: index 0 is the default speed, then 250k, 500k, 1M, 2M
+#define SERIAL_SPEED_MAX_INDEX 4
+#define SERIAL_SPEED(I) ((I) == 0 ? 57600 : (250000 << ((I) - 1)))
+// maximal time the programmer waits for the probe and its confirmation
+#define SERIAL_SPEED_PROBE_TIMEOUT 1000
+
+// daemon mode: the serial session is kept open and jobs are received via a local socket
+// placed in $XDG_RUNTIME_DIR, or in /tmp with the user id appended to the name
+#define DAEMON_SOCKET_NAME "afterburner"
+#define DAEMON_MAX_REQUEST (16 * 1024)
+// the idle session is checked periodically, this also keeps the programmer on the negotiated speed
+#define DAEMON_KEEPALIVE_TIME 5000
+
+// compressed XSVF stream (LZSS): history size of the JTAG player, match length 3 - 258
+#define XSVF_LZ_WINDOW 128
+#define XSVF_LZ_MIN_MATCH 3
+#define XSVF_LZ_MAX_MATCH 258
+
 
 typedef enum {
     UNKNOWN,
@@ -133,6 +184,9 @@ char* deviceName = 0;
 char* pesString = NULL;
 
 SerialDeviceHandle serialF = INVALID_HANDLE;
+char serialRx[SERIAL_RX_SIZE];
+unsigned int serialRxStart = 0; //read position, wraps around via SERIAL_RX_MASK
+unsigned int serialRxEnd = 0;   //write position, wraps around via SERIAL_RX_MASK
 Galtype gal;
 int security = 0;
 unsigned short checksum;
@@ -144,6 +198,24 @@ char printSerialWhileWaiting = 0;
 int calOffset = 0; //no calibration offset is applied
 char enableSecurity = 0;
 char bigRam = 0;
+char binUpload = 0;
+char deltaUpload = 0;
+char binRead = 0;
+char binStream = 0;
+char binVerify = 0;
+char verifyMap = 0;
+char blankCheck = 0;
+char adaptiveProg = 0;
+char adaptiveErase = 0;
+char writeVerify = 0;
+char jobCommand = 0;
+char powerSession = 0;
+int speedIndex = 0;     //requested serial speed index
+int linkSpeedIndex = 0; //current serial speed index
+char daemonMode = 0;
+char* daemonSocketPath = NULL;
+char serialLost = 0;    //serial I/O failed, the session must be re-opened
+char noXsvfCompress = 0;
 
 char opRead = 0;
 char opWrite = 0;
@@ -157,9 +229,15 @@ char opSecureGal = 0;
 char opWritePes = 0;
 char flagEnableApd = 0;
 char flagEraseAll = 0;
+char flagNoBlankCheck = 0;
+int pulseCap = 0;       //max. adaptive program pulses per fuse row, 0: fixed pulse
+int erasePulseCap = 0;  //max. adaptive erase pulses, 0: fixed pulse
 
 
 static int waitForSerialPrompt(char* buf, int bufSize, int maxDelay);
+static int readSerialUntil(char* buf, int bufSize, const char* delim, int maxDelay);
+static void negotiateLinkSpeed(void);
+static char setLinkSpeed(int index);
 static char sendGenericCommand(const char* command, const char* errorText, int maxDelay, char printResult);
 
 static void printGalTypes() {
@@ -197,10 +275,22 @@ static void printHelp() {
     printf("  -f <file> : JEDEC fuse map file\n");
     printf("  -d <serial_device> : name of the serial device. Without this option the device is guessed.\n");
     printf("                       serial params are: 57600, 8N1\n");
+    printf("  -speed <baud|max> : switch to a faster serial speed after connecting: 250000, 500000, 1000000\n");
+    printf("                      or 2000000. Slower speeds are tried if the link does not work.\n");
+    printf("  -daemon : keep the serial connection open and serve the operations requested by other\n");
+    printf("            afterburner invocations (also used when the program is named afterburnerd)\n");
+    printf("  -sock <path> : local socket of the daemon, default: $XDG_RUNTIME_DIR/" DAEMON_SOCKET_NAME ".sock\n");
+    printf("                 or /tmp/" DAEMON_SOCKET_NAME "-<uid>.sock\n");
     printf("  -nc : do not check device GAL type before operation: force the GAL type set on command line\n");
+    printf("  -nz : do not compress the XSVF data sent to the JTAG player\n");
+    printf("  -ap <cap> : use with 'w' command to program the fuse rows with short pulses, each row is read\n");
+    printf("              back and pulsed again until it matches. Cap: max. pulses per row 1-15, 8 is a good start.\n");
     printf("  -sec: enable security - protect the chip. Use with 'w' or 'v' commands.\n");
     printf("  -co <offset>: Set calibration offset. Use with 'b' command. Value: -20 (-0.2V) to 25 (+0.25V)\n");
     printf("  -all: use with 'e' command to erase all data including PES.\n");
+    printf("  -ae <cap> : use with 'e' command to erase with short pulses, the GAL is blank checked after\n");
+    printf("              each pulse. Cap: max. erase pulses 1-15, 8 is a good start.\n");
+    printf("  -nb : use with 'e' command to always erase the GAL chip. Blank chips are not erased by default.\n");
     printf("  -pes <PES> : use with 'p' command to specify new PES. PES format is 8 hex bytes with a delimiter.\n");
     printf("               For example 00:03:3A:A1:00:00:00:90\n");
     printf("examples:\n");
@@ -261,6 +351,21 @@ static int8_t verifyArgs(char* type) {
     return 0;
 }
 
+static int8_t parseSpeed(char* value) {
+    speedIndex = 0;
+    if (value != NULL && strcmp("max", value) == 0) {
+        speedIndex = SERIAL_SPEED_MAX_INDEX;
+    } else if (value != NULL) {
+        int speed = atoi(value);
+        for (speedIndex = SERIAL_SPEED_MAX_INDEX; speedIndex > 0 && SERIAL_SPEED(speedIndex) != speed; speedIndex--);
+    }
+    if (speedIndex == 0) {
+        printf("Error: unsupported serial speed. Use 250000, 500000, 1000000, 2000000 or max.\n");
+        return -1;
+    }
+    return 0;
+}
+
 static int8_t checkArgs(int argc, char** argv) {
     int i;
     char* type = 0;
@@ -283,10 +388,28 @@ static int8_t checkArgs(int argc, char** argv) {
             deviceName = argv[i];
         } else if (strcmp("-nc", param) == 0) {
             noGalCheck = 1;
+        } else if (strcmp("-nz", param) == 0) {
+            noXsvfCompress = 1;
         } else if (strcmp("-sec", param) == 0) {
             opSecureGal = 1;
         } else if (strcmp("-all", param) == 0) {
             flagEraseAll = 1;
+        } else if (strcmp("-ap", param) == 0) {
+            i++;
+            pulseCap = atoi(argv[i]);
+            if (pulseCap < 1 || pulseCap > 15) {
+                printf("Error: adaptive pulse cap out of range (1..15 inclusive).\n");
+                return -1;
+            }
+        } else if (strcmp("-ae", param) == 0) {
+            i++;
+            erasePulseCap = atoi(argv[i]);
+            if (erasePulseCap < 1 || erasePulseCap > 15) {
+                printf("Error: adaptive erase cap out of range (1..15 inclusive).\n");
+                return -1;
+            }
+        } else if (strcmp("-nb", param) == 0) {
+            flagNoBlankCheck = 1;
         }  else if (strcmp("-pes", param) == 0) {
             i++;
             pesString = argv[i];
@@ -302,6 +425,15 @@ static int8_t checkArgs(int argc, char** argv) {
                 calOffset = 32;
             }
         }
+        else if (strcmp("-speed", param) == 0) {
+            i++;
+            if (parseSpeed(i < argc ? argv[i] : NULL)) {
+                return -1;
+            }
+        }
+        else if (strcmp("-sock", param) == 0) {
+            i++;
+        }
         else if (param[0] != '-') {
             modes = param;
         }
@@ -596,6 +728,10 @@ static int openSerial(void) {
     int total;
     int labelPos;
 
+    // the daemon keeps the session open between the operations
+    if (daemonMode && serialF != INVALID_HANDLE) {
+        return 0;
+    }
 
     //open device name
     if (deviceName == 0) {
@@ -638,6 +774,36 @@ static int openSerial(void) {
         if (verbose && bigRam) {
             printf("MCU Big RAM detected\n");
         }
+        // check for binary framed upload
+        binUpload = checkForString(buf, labelPos, " BIN-UP ");
+        if (verbose && binUpload) {
+            printf("binary upload supported\n");
+        }
+        // check for delta upload against the resident fuse map
+        deltaUpload = checkForString(buf, labelPos, " DELTA-UP ");
+        // check for binary fuse-map read-back
+        binRead = checkForString(buf, labelPos, " BIN-READ ");
+        // check for the fuse rows streamed while the GAL is read
+        binStream = checkForString(buf, labelPos, " BIN-STREAM ");
+        // check for the verification of the streamed fuse rows
+        binVerify = checkForString(buf, labelPos, " BIN-VERIFY ");
+        // check for the verify mismatch map
+        verifyMap = checkForString(buf, labelPos, " VERIFY-MAP ");
+        // check for the blank check of the GAL chip
+        blankCheck = checkForString(buf, labelPos, " BLANK-CHECK ");
+        // check for the adaptive programming of the fuse rows
+        adaptiveProg = checkForString(buf, labelPos, " ADAPTIVE-PROG ");
+        // check for the adaptive erase
+        adaptiveErase = checkForString(buf, labelPos, " ADAPTIVE-ERASE ");
+        // check for the verification of the fuse rows while they are written
+        writeVerify = checkForString(buf, labelPos, " WRITE-VERIFY ");
+        // check for the erase, write, verify and secure job
+        jobCommand = checkForString(buf, labelPos, " JOB ");
+        // check for the GAL power kept between the commands
+        powerSession = checkForString(buf, labelPos, " POWER-SESSION ");
+        if (speedIndex > 0 && linkSpeedIndex == 0) {
+            negotiateLinkSpeed();
+        }
         //all OK
         return 0;
     }
@@ -649,12 +815,31 @@ static int openSerial(void) {
     return -4;
 }
 
-static void closeSerial(void) {
+static void closeSerialSession(void) {
     if (INVALID_HANDLE == serialF) {
         return;
     }
-    serialDeviceClose(serialF);
+    // the next connection starts with the default speed
+    if (linkSpeedIndex > 0 && !serialLost) {
+        setLinkSpeed(0);
+    }
+    if (serialLost) {
+        serialDeviceDrop(serialF);
+    } else {
+        serialDeviceClose(serialF);
+    }
     serialF = INVALID_HANDLE;
+    serialRxStart = serialRxEnd = 0;
+    linkSpeedIndex = 0;
+    serialLost = 0;
+}
+
+static void closeSerial(void) {
+    // the daemon closes the session only when the serial line failed
+    if (daemonMode) {
+        return;
+    }
+    closeSerialSession();
 }
 
 
@@ -715,6 +900,79 @@ static char* findLastLine(char* buf) {
     return result;
 }
 
+static long long getTimeMs(void) {
+#ifndef _USE_WIN_API_
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long long) t.tv_sec * 1000 + t.tv_nsec / 1000000;
+#else
+    return (long long) GetTickCount64();
+#endif
+}
+
+// number of received bytes waiting in the ring buffer
+#define SERIAL_RX_AVAILABLE() (serialRxEnd - serialRxStart)
+// received byte at offset 'I' from the read position
+#define SERIAL_RX_PEEK(I) serialRx[(serialRxStart + (I)) & SERIAL_RX_MASK]
+
+// Waits until the serial data arrive and appends them to the receive ring buffer.
+// Returns the number of bytes received, 0 on timeout or when the buffer is full, -1 on error.
+static int serialReceive(int maxDelay) {
+    int readSize;
+    int pos = serialRxEnd & SERIAL_RX_MASK;
+    int space = SERIAL_RX_SIZE - SERIAL_RX_AVAILABLE();
+
+    // read as much as possible in one call: up to the end of the array or the read position
+    if (space > SERIAL_RX_SIZE - pos) {
+        space = SERIAL_RX_SIZE - pos;
+    }
+    if (space <= 0) {
+        return 0;
+    }
+    readSize = serialDeviceWait(serialF, maxDelay);
+    if (readSize <= 0) {
+        serialLost |= (readSize < 0);
+        return readSize;
+    }
+    readSize = serialDeviceRead(serialF, serialRx + pos, space);
+    if (readSize < 0) {
+        if (errno == EAGAIN || errno == EINTR) {
+            return 0;
+        }
+        serialLost = 1;
+        return -1;
+    }
+    serialRxEnd += readSize;
+    return readSize;
+}
+
+// Reads from the serial port until the delimiter is received, the buffer is full
+// or the time runs out. Without the delimiter exactly 'bufSize' bytes are read.
+// Returns the number of bytes stored in the buffer (including the delimiter).
+static int readSerialUntil(char* buf, int bufSize, const char* delim, int maxDelay) {
+    long long deadline = getTimeMs() + maxDelay;
+    int delimLen = (delim == NULL) ? 0 : strlen(delim);
+    int total = 0;
+
+    while (1) {
+        // consume the received data
+        while (serialRxStart != serialRxEnd && total < bufSize) {
+            buf[total++] = serialRx[serialRxStart++ & SERIAL_RX_MASK];
+            if (delimLen && total >= delimLen && buf[total - 1] == delim[delimLen - 1] &&
+                0 == memcmp(buf + total - delimLen, delim, delimLen)) {
+                return total;
+            }
+        }
+        if (total >= bufSize) {
+            return total;
+        }
+        maxDelay = (int) (deadline - getTimeMs());
+        if (maxDelay <= 0 || serialReceive(maxDelay) < 0) {
+            return total;
+        }
+    }
+}
+
 static char* printBuffer(char* bufPrint, int readSize) {
     int i;
     char doPrint = 1;
@@ -733,64 +991,63 @@ static char* printBuffer(char* bufPrint, int readSize) {
     return bufPrint;
 }
 
+// Waits for the programmer's prompt. Lines received in the meantime are optionally printed.
+// Returns the number of bytes received or -1 when the buffer is too small.
 static int waitForSerialPrompt(char* buf, int bufSize, int maxDelay) {
-    char* bufStart = buf;
-    int bufTotal = bufSize;
+    long long deadline = getTimeMs() + maxDelay;
     int bufPos = 0;
-    int readSize;
-    char* bufPrint = buf;
-    char doPrint = printSerialWhileWaiting;
-    
+
     memset(buf, 0, bufSize);
 
-    while (maxDelay > 0) {
-        readSize = serialDeviceRead(serialF, buf, bufSize);
-        if (readSize > 0) {
-            bufPos += readSize;
-            if (checkPromptExists(bufStart, bufTotal) >= 0) {
-                maxDelay = 4; //force exit, but read the rest of the line
-            } else {
-                buf += readSize;
-                bufSize -= readSize;
-                if (bufSize <= 0) {
-                    printf("ERROR: serial port read buffer is too small!\nAre you dumping large amount of data?\n");
-                    return -1;
-                }
-            }
-            if (printSerialWhileWaiting) {
-                bufPrint = printBuffer(bufPrint, readSize);
-            }                
+    while (1) {
+        int remaining = (int) (deadline - getTimeMs());
+        int readSize = readSerialUntil(buf + bufPos, bufSize - 1 - bufPos, "\n", remaining > 0 ? remaining : 0);
+
+        if (printSerialWhileWaiting && readSize > 0) {
+            printBuffer(buf + bufPos, readSize);
         }
-        if (maxDelay > 0) {
-        /* WIN_API handles timeout itself */
-#ifndef _USE_WIN_API_
-            usleep(10 * 1000);
-            maxDelay -= 10;
-#else
-            maxDelay -= 30;           
-#endif
-            if(maxDelay <= 0 && verbose) {
+        bufPos += readSize;
+        // the prompt ends the line
+        if (bufPos >= 3 && 0 == memcmp(buf + bufPos - 3, ">\r\n", 3)) {
+            break;
+        }
+        if (bufPos >= bufSize - 1) {
+            printf("ERROR: serial port read buffer is too small!\nAre you dumping large amount of data?\n");
+            return -1;
+        }
+        if (remaining <= 0) {
+            if (verbose) {
                 printf("waitForSerialPrompt timed out\n");
             }
+            break;
         }
     }
     return bufPos;
 }
 
-static int sendBuffer(char* buf) {
-    int total;
+static void sleepMs(int ms) {
+#ifndef _USE_WIN_API_
+    usleep(ms * 1000);
+#else
+    Sleep(ms);
+#endif
+}
+
+static int sendBytes(char* buf, int total) {
     int writeSize;
 
-    if (buf == 0) {
-        return -1;
-    }
-    total = strlen(buf);
     // write the query into the serial port's file
     // file is opened non blocking so we have to ensure all contents is written
     while (total > 0) {
         writeSize = serialDeviceWrite(serialF, buf, total);
+        if (writeSize < 0 && (errno == EAGAIN || errno == EINTR)) {
+            // the output queue of the non blocking port is full
+            sleepMs(1);
+            continue;
+        }
         if (writeSize < 0) {
             printf("ERROR: written: %i (%s)\n", writeSize, strerror(errno));
+            serialLost = 1;
             return -4;
         }
         buf += writeSize;
@@ -799,6 +1056,35 @@ static int sendBuffer(char* buf) {
     return 0;
 }
 
+static int sendBuffer(char* buf) {
+    if (buf == 0) {
+        return -1;
+    }
+    return sendBytes(buf, strlen(buf));
+}
+
+// reads exactly 'size' bytes unless the time runs out, returns the number of bytes read
+static int readSerialBytes(char* buf, int size, int maxDelay) {
+    return readSerialUntil(buf, size, NULL, maxDelay);
+}
+
+// reads a single non-empty line of text (without the new line characters)
+static int readSerialLine(char* buf, int bufSize, int maxDelay) {
+    long long deadline = getTimeMs() + maxDelay;
+    int len = 0;
+
+    while (len == 0 && maxDelay > 0) {
+        len = readSerialUntil(buf, bufSize - 1, "\n", maxDelay);
+        // strip the new line characters
+        while (len > 0 && (buf[len - 1] == '\r' || buf[len - 1] == '\n')) {
+            len--;
+        }
+        maxDelay = (int) (deadline - getTimeMs());
+    }
+    buf[len] = 0;
+    return len;
+}
+
 static int sendLine(char* buf, int bufSize, int maxDelay) {
     int total;
     char* obuf = buf;
@@ -836,155 +1122,808 @@ static void updateProgressBar(char* label, int current, int total) {
     }
 }
 
-// Upload fusemap in byte format (as opposed to bit format used in JEDEC file).
-static char upload() {
-    char fuseSet;
-    char* buf = malloc(MAX_LINE);
-    char line[64];
-    int i, j;
-    unsigned short csum;
-    int apdFuse = flagEnableApd;
-    int totalFuses = galinfo[gal].fuses;
+static unsigned short crc16(unsigned short crc, const unsigned char* data, int len) {
+    int i;
+    while (len-- > 0) {
+        crc ^= ((unsigned short) *data++) << 8;
+        for (i = 0; i < 8; i++) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+        }
+    }
+    return crc;
+}
 
-    if (apdFuse) {
-        totalFuses++;
+// Builds a binary frame, returns the frame size.
+static int buildFrame(unsigned char* frame, int seq, int addr, const unsigned char* payload, int len) {
+    unsigned short crc;
+
+    frame[0] = (unsigned char) len;
+    frame[1] = (unsigned char) seq;
+    frame[2] = (unsigned char) (addr & 0xFF);
+    frame[3] = (unsigned char) (addr >> 8);
+    memcpy(frame + FRAME_HEADER_SIZE, payload, len);
+    crc = crc16(0xFFFF, frame, FRAME_HEADER_SIZE + len);
+    frame[FRAME_HEADER_SIZE + len] = (unsigned char) (crc & 0xFF);
+    frame[FRAME_HEADER_SIZE + len + 1] = (unsigned char) (crc >> 8);
+    return FRAME_HEADER_SIZE + len + FRAME_CRC_SIZE;
+}
+
+// Packs the fusemap into bytes, the first fuse is stored in bit 0.
+static void packFuses(unsigned char* dst, int totalFuses) {
+    int i;
+
+    memset(dst, 0, (totalFuses + 7) / 8);
+    for (i = 0; i < totalFuses; i++) {
+        if (fusemap[i]) {
+            dst[i >> 3] |= (1 << (i & 7));
+        }
     }
+}
 
-    // Start  upload
-    sprintf(buf, "u\r");
-    sendLine(buf, MAX_LINE, 20);
+// Sends the prepared binary frames ('frameStride' bytes apart) and waits for their acknowledgement.
+// Up to 'window' frames are sent ahead, the corrupted and lost frames are sent again.
+// 'frameAddr' is the progress of each frame out of 'progressTotal'.
+// Returns 0 on success, -1 on error.
+static char sendFrames(const unsigned char* frames, int frameStride, const int* frameSize, const int* frameAddr,
+                       int count, int window, int progressTotal) {
+    int base = 0;
+    int next = 0;
+    int retries = 0;
+    int i;
 
-    //device type
-    sprintf(buf, "#t %c %s\r", '0' + (int) gal, galinfo[gal].name);
-    sendLine(buf, MAX_LINE, 300);
+    while (base < count) {
+        unsigned char reply[2];
 
-    //fuse map
-    buf[0] = 0;
-    fuseSet = 0;
-    
-    printf("Uploading fuse map...\n");
-    for (i = 0; i < totalFuses;) {
-        unsigned char f = 0;
-        if (i % 32 == 0) {
-            if (i != 0) {
-                strcat(buf, "\r");
-                //the buffer contains at least one fuse set to 1
-                if (fuseSet) {
-#ifdef DEBUG_UPLOAD
-                    printf("%s\n", buf);
-#endif
-                    sendLine(buf, MAX_LINE, 100);
-                    buf[0] = 0;
-                }
-                fuseSet = 0;
+        // fill the window
+        while (next < count && next - base < window) {
+            if (sendBytes((char*) frames + next * frameStride, frameSize[next])) {
+                return -1;
             }
-            sprintf(buf, "#f %04i ", i);
+            next++;
         }
-        f = 0;
-        for (j = 0; j < 8 && i < totalFuses; j++,i++) {
-            if (fusemap[i]) {
-                f |= (1 << j);
-                fuseSet = 1;
+
+        if (readSerialBytes((char*) reply, 2, 1000) != 2) {
+            if (++retries > FRAME_RETRIES) {
+                printf("Error: binary transfer timed out\n");
+                return -1;
+            }
+            // resend all unacknowledged frames
+            next = base;
+            continue;
+        }
+        // find the acknowledged / rejected frame among the unacknowledged frames
+        for (i = base; i < next && (i & 0xFF) != reply[1]; i++);
+
+        if (reply[0] == FRAME_ACK) {
+            if (i < next) {
+                base = i + 1;
+                retries = 0;
+                if (frameAddr[i] < progressTotal) {
+                    updateProgressBar("", frameAddr[i], progressTotal);
+                }
             }
+        } else if (reply[0] == FRAME_NAK) {
+            if (++retries > FRAME_RETRIES) {
+                printf("Error: binary transfer failed, too many corrupted frames\n");
+                return -1;
+            }
+            if (verbose) {
+                printf("frame %d rejected\n", reply[1]);
+            }
+            if (i < next) {
+                base = i;
+            }
+            // let the programmer discard the rest of the window, then resend
+            sleepMs(50);
+            next = base;
+        } else {
+            printf("Error: unexpected binary transfer reply: 0x%02X\n", reply[0]);
+            return -1;
         }
+    }
+    updateProgressBar("", progressTotal, progressTotal);
+    return 0;
+}
 
-        sprintf(line, "%02X", f);
-        strcat(buf, line);
+// Upload fusemap in binary frames. Only the frames with at least one fuse set are sent.
+// When 'hashes' of the resident fuse map are passed, only the frames which differ are sent.
+// Up to 'window' frames are sent ahead without waiting for the acknowledgement.
+// Returns 0 on success, 1 when the programmer refused binary mode, -1 on error.
+static char uploadFrames(int totalFuses, const unsigned short* hashes, int hashCount, int hashFuses) {
+    char buf[MAX_LINE];
+    unsigned char packed[MAXFUSES / 8 + 1];
+    unsigned char* frames;
+    int* frameAddr;
+    int* frameSize;
+    int window = 0;
+    int maxPayload = 0;
+    int count = 0;
+    int i;
+    char result;
 
-        updateProgressBar("", i, totalFuses);
+    sendBuffer("#b\r");
+    readSerialLine(buf, sizeof(buf), 300);
+    if (strncmp(buf, "OK bin ", 7) != 0 || sscanf(buf + 7, "%d %d", &window, &maxPayload) != 2 || window < 1) {
+        if (verbose) {
+            printf("binary upload refused: '%s'\n", buf);
+        }
+        waitForSerialPrompt(buf, MAX_LINE, 300);
+        return 1;
     }
-    updateProgressBar("", totalFuses, totalFuses);
-
-    // send last unfinished fuse line
-    if (fuseSet) {
-        strcat(buf, "\r");
-#ifdef DEBUG_UPLOAD
-        printf("%s\n", buf);
-#endif
-        sendLine(buf, MAX_LINE, 100);
+    if (maxPayload > FRAME_MAX_PAYLOAD) {
+        maxPayload = FRAME_MAX_PAYLOAD;
     }
-
-    //checksum
-    csum = checkSum(totalFuses);
     if (verbose) {
-        printf("sending csum: %04X\n", csum);
+        printf("binary upload: window=%d payload=%d\n", window, maxPayload);
+    }
+
+    // prepare all frames in advance so they can be resent quickly
+    count = (totalFuses + maxPayload * 8 - 1) / (maxPayload * 8) + 1;
+    frames = malloc(count * FRAME_MAX_SIZE);
+    frameAddr = malloc(count * sizeof(int));
+    frameSize = malloc(count * sizeof(int));
+    packFuses(packed, totalFuses);
+
+    count = 0;
+    for (i = 0; i < totalFuses; i += maxPayload * 8) {
+        int j;
+        int len = (totalFuses - i + 7) / 8;
+        if (len > maxPayload) {
+            len = maxPayload;
+        }
+        if (hashes != NULL) {
+            // delta upload: skip the blocks matching the resident fuse map
+            j = (hashFuses == maxPayload * 8 && i / hashFuses < hashCount &&
+                 hashes[i / hashFuses] == crc16(0xFFFF, packed + i / 8, len)) ? len : 0;
+        } else {
+            // fusemap is cleared by the programmer, skip all-zero blocks
+            for (j = 0; j < len && packed[i / 8 + j] == 0; j++);
+        }
+        if (j < len) {
+            frameAddr[count] = i;
+            frameSize[count] = buildFrame(frames + count * FRAME_MAX_SIZE, count, i, packed + i / 8, len);
+            count++;
+        }
     }
-    sprintf(buf, "#c %04X\r", csum);
-    sendLine(buf, MAX_LINE, 300);
+    // end of transfer
+    frameAddr[count] = totalFuses;
+    frameSize[count] = buildFrame(frames + count * FRAME_MAX_SIZE, count, 0, packed, 0);
+    count++;
 
-    free(buf);
-    //end of upload
-    return sendGenericCommand("#e\r", "Upload failed", 300, 0); 
-
-}
-
-//returns 0 on success
-static char sendGenericCommand(const char* command, const char* errorText, int maxDelay, char printResult) {
-    char buf[MAX_LINE];
-    int readSize;
+    if (hashes != NULL && verbose) {
+        printf("delta upload: %d changed blocks\n", count - 1);
+    }
+    printf("Uploading fuse map...\n");
+    result = sendFrames(frames, FRAME_MAX_SIZE, frameSize, frameAddr, count, window, totalFuses);
 
-    sprintf(buf, "%s", command);
-    readSize = sendLine(buf, MAX_LINE, maxDelay);
-    if (readSize < 0)  {
+    free(frames);
+    free(frameAddr);
+    free(frameSize);
+    // read the upload status and the prompt
+    if (waitForSerialPrompt(buf, MAX_LINE, 1000) > 0) {
+        char* response = stripPrompt(buf);
         if (verbose) {
-            printf("%s\n", errorText);
+            printf("read: '%s'\n", response);
         }
-        return -1;
-    } else {
-        char* response = stripPrompt(buf);
-        char* lastLine = findLastLine(response);
-        if (lastLine == 0 || (lastLine[0] == 'E' && lastLine[1] == 'R')) {
-            printf("%s\n", response);
-            return -1;
-        } else if (printResult && printSerialWhileWaiting == 0) {
+        if (strstr(response, "ER") != NULL) {
             printf("%s\n", response);
+            result = -1;
         }
     }
-    return 0;
+    return result;
 }
 
-static char operationWriteOrVerify(char doWrite) {
-
-    char result;
-
-    if (readFile(NULL)) {
-        return -1;
-    }
-
-    result = parseFuseMap(galbuffer);
-    if (verbose) {
-        printf("parse result=%i\n", result);
-    }
+// Switches the serial speed of the programmer and the PC, then checks the link
+// by sending a probe frame which the programmer echoes back. Returns 0 on success.
+static char setLinkSpeed(int index) {
+    static const unsigned char probePattern[FRAME_MAX_PAYLOAD] = {
+        0x00, 0xFF, 0x55, 0xAA, 0x0F, 0xF0, 0x33, 0xCC, 0x01, 0x80, 0x7F, 0xFE, 0x5A, 0xA5, 0x0D, 0x0A
+    };
+    char buf[MAX_LINE];
+    unsigned char probe[FRAME_MAX_SIZE];
+    unsigned char echo[FRAME_MAX_SIZE];
 
-    if (openSerial() != 0) {
+    sprintf(buf, "n%d\r", index);
+    sendBuffer(buf);
+    readSerialLine(buf, sizeof(buf), 500);
+    if (strncmp(buf, "OK speed ", 9) != 0) {
+        if (verbose) {
+            printf("serial speed refused: '%s'\n", buf);
+        }
+        waitForSerialPrompt(buf, MAX_LINE, 300);
         return -1;
     }
-
-    // set power-down fuse bit (do it before upload to correctly calculate check-sum)
-    result = sendGenericCommand(flagEnableApd ? "z\r" : "Z\r", "APD set failed ?", 4000, 0);
-    if (result) {
-        goto finish;
+    if (serialDeviceSetSpeed(serialF, SERIAL_SPEED(index))) {
+        // the programmer reverts to the default speed as the probe does not arrive
+        goto resync;
     }
-    result = upload();
-    if (result) {
-        return result;
+    linkSpeedIndex = index;
+    if (index == 0) {
+        waitForSerialPrompt(buf, MAX_LINE, 300);
+        return 0;
     }
 
-    // write command
-    if (doWrite) {
-        result = sendGenericCommand("w\r", "write failed ?", 8000, 0);
-        if (result) {
-            goto finish;
+    // let the programmer switch the speed
+    sleepMs(10);
+    buildFrame(probe, 0, 0, probePattern, FRAME_MAX_PAYLOAD);
+    sendBytes((char*) probe, FRAME_MAX_SIZE);
+    if (readSerialBytes((char*) echo, FRAME_MAX_SIZE, 500) == FRAME_MAX_SIZE && 0 == memcmp(probe, echo, FRAME_MAX_SIZE)) {
+        // confirm the echo was received intact
+        echo[0] = FRAME_ACK;
+        echo[1] = 0;
+        sendBytes((char*) echo, 2);
+        if (waitForSerialPrompt(buf, MAX_LINE, 300) > 0 && checkPromptExists(buf, MAX_LINE) >= 0 && strstr(buf, "ER") == NULL) {
+            return 0;
         }
     }
 
-    // verify command
-    if (opVerify) {
-        result = sendGenericCommand("v\r", "verify failed ?", 8000, 0);
-    }
-finish:
-    closeSerial();
-    return result;
+    // probe failed: both sides revert to the default speed
+    serialDeviceSetSpeed(serialF, SERIAL_SPEED(0));
+    linkSpeedIndex = 0;
+
+resync:
+    // wait for the programmer to give up the probe, discard the garbled output
+    // and check the programmer responds again
+    sleepMs(SERIAL_SPEED_PROBE_TIMEOUT);
+    while (readSerialBytes(buf, MAX_LINE, 50) > 0);
+    sendBuffer("*\r");
+    waitForSerialPrompt(buf, MAX_LINE, 1000);
+    return -1;
+}
+
+// Tries the requested serial speed, then slower speeds. The working speed is
+// remembered for the subsequent connections.
+static void negotiateLinkSpeed(void) {
+    for (; speedIndex > 0; speedIndex--) {
+        int speed = SERIAL_SPEED(speedIndex);
+
+        // skip speeds not supported by the PC serial port
+        if (serialDeviceSetSpeed(serialF, speed)) {
+            if (verbose) {
+                printf("serial speed %d not supported by the serial port\n", speed);
+            }
+            continue;
+        }
+        serialDeviceSetSpeed(serialF, SERIAL_SPEED(0));
+
+        if (0 == setLinkSpeed(speedIndex)) {
+            if (verbose) {
+                printf("serial speed set to %d\n", speed);
+            }
+            return;
+        }
+        if (verbose) {
+            printf("serial speed %d failed\n", speed);
+        }
+    }
+}
+
+// Uploads the blocks of the fusemap which differ from the fuse map resident in the programmer
+// (for example when the same design is written into many chips), then checks the checksum.
+// Returns 0 on success, 1 when the delta upload is not possible, -1 on error.
+static char uploadDelta(unsigned short csum) {
+    char buf[MAX_LINE];
+    unsigned short hashes[MAXFUSES / (FRAME_MAX_PAYLOAD * 8) + 1];
+    int hashCount = 0;
+    int hashFuses = 0;
+    int i;
+    char* pos;
+    char result;
+
+    // start upload, keep the resident fuse map
+    sprintf(buf, "uk\r");
+    sendLine(buf, MAX_LINE, 20);
+    sprintf(buf, "#t %c %s\r", '0' + (int) gal, galinfo[gal].name);
+    sendLine(buf, MAX_LINE, 300);
+
+    // hashes of the resident fuse map blocks
+    sprintf(buf, "#h\r");
+    if (sendLine(buf, MAX_LINE, 1000) <= 0) {
+        return -1;
+    }
+    pos = strstr(buf, "OK hash ");
+    if (pos == NULL || sscanf(pos + 8, "%d %d", &hashCount, &hashFuses) != 2 ||
+        hashCount <= 0 || hashCount > (int) (sizeof(hashes) / sizeof(hashes[0]))) {
+        if (verbose) {
+            printf("delta upload refused: '%s'\n", stripPrompt(buf));
+        }
+        goto refused;
+    }
+    pos = strchr(pos, '\n');
+    for (i = 0; i < hashCount && pos != NULL; i++) {
+        unsigned int h;
+        if (sscanf(pos, " %4x", &h) != 1) {
+            break;
+        }
+        hashes[i] = (unsigned short) h;
+        pos = strpbrk(pos + 1, " \n");
+    }
+    if (i < hashCount) {
+        printf("Warning: resident fuse map hashes are corrupted\n");
+        goto refused;
+    }
+
+    // the hashes cover the APD fuse slot too
+    result = uploadFrames(galinfo[gal].fuses + 1, hashes, hashCount, hashFuses);
+    if (result < 0) {
+        return result;
+    }
+    if (result > 0) {
+        goto refused;
+    }
+
+    // the whole fuse map must match
+    if (verbose) {
+        printf("sending csum: %04X\n", csum);
+    }
+    sprintf(buf, "#c %04X\r", csum);
+    if (sendLine(buf, MAX_LINE, 300) > 0 && strstr(buf, "OK checksum") != NULL) {
+        return sendGenericCommand("#e\r", "Upload failed", 300, 0);
+    }
+    printf("Warning: delta upload checksum failed, uploading the whole fuse map\n");
+
+refused:
+    // leave the upload mode, the caller uploads the whole fuse map
+    sprintf(buf, "#e\r");
+    sendLine(buf, MAX_LINE, 300);
+    return 1;
+}
+
+// Returns the output pin of the OLMC which uses the product term 'bit' of a fuse row, 0 when not known.
+static int productTermPin(int bit) {
+    // product terms of 22V10 OLMCs (pin 23 to 14) including the output enable term
+    static const int terms22V10[] = {9, 11, 13, 15, 17, 17, 15, 13, 11, 9};
+    int i;
+
+    switch (gal) {
+    case GAL16V8:
+    case ATF16V8B:
+        return 19 - bit / 8;
+    case GAL20V8:
+    case ATF20V8B:
+        return 22 - bit / 8;
+    case GAL22V10:
+    case ATF22V10B:
+    case ATF22V10C:
+        // the first term is AR, the last one is SP
+        bit--;
+        for (i = 0; i < 10 && bit >= 0; i++) {
+            if (bit < terms22V10[i]) {
+                return 23 - i;
+            }
+            bit -= terms22V10[i];
+        }
+        return 0;
+    default:
+        return 0;
+    }
+}
+
+// Prints the indices of the bits set in the 'map' as ranges, nothing when no bit is set.
+static void printBitRanges(const char* label, const unsigned char* map, int count) {
+    int i = 0;
+    char found = 0;
+
+    while (i < count) {
+        int start;
+        if (!(map[i >> 3] & (1 << (i & 7)))) {
+            i++;
+            continue;
+        }
+        if (!found) {
+            printf("%s:", label);
+            found = 1;
+        }
+        for (start = i; i < count && (map[i >> 3] & (1 << (i & 7))); i++);
+        if (i - start > 1) {
+            printf(" %d-%d", start, i - 1);
+        } else {
+            printf(" %d", start);
+        }
+    }
+    if (found) {
+        printf("\n");
+    }
+}
+
+// Reads the verify mismatch map frame and prints the fuse rows and regions which failed.
+// 'params' are the fuse rows and row bits from the "OK bin map" line.
+static void printVerifyMap(const char* params) {
+    unsigned char frame[FRAME_HEADER_SIZE + FRAME_READ_PAYLOAD + FRAME_CRC_SIZE];
+    unsigned char pins[4] = {0};
+    unsigned char* map = frame + FRAME_HEADER_SIZE;
+    unsigned short crc;
+    int rows = 0;
+    int bits = 0;
+    int rowBytes, len, i;
+    char otherTerms = 0;
+
+    if (sscanf(params, "%d %d", &rows, &bits) != 2 || rows <= 0 || bits <= 0) {
+        return;
+    }
+    rowBytes = (rows + 7) / 8;
+    len = rowBytes + (bits + 7) / 8 + 1;
+    if (len > FRAME_READ_PAYLOAD ||
+        readSerialBytes((char*) frame, FRAME_HEADER_SIZE + len + FRAME_CRC_SIZE, 2000) != FRAME_HEADER_SIZE + len + FRAME_CRC_SIZE) {
+        return;
+    }
+    crc = crc16(0xFFFF, frame, FRAME_HEADER_SIZE + len);
+    if (frame[0] != len || frame[FRAME_HEADER_SIZE + len] != (crc & 0xFF) || frame[FRAME_HEADER_SIZE + len + 1] != (crc >> 8)) {
+        printf("Warning: verify mismatch map is corrupted\n");
+        return;
+    }
+
+    printBitRanges("Mismatched fuse rows", map, rows);
+    // product terms are mapped to the output pins where possible
+    for (i = 0; i < bits; i++) {
+        if (map[rowBytes + (i >> 3)] & (1 << (i & 7))) {
+            int pin = productTermPin(i);
+            if (pin > 0) {
+                pins[pin >> 3] |= (1 << (pin & 7));
+            } else {
+                otherTerms = 1;
+            }
+        }
+    }
+    if (otherTerms) {
+        printBitRanges("Mismatched product terms", map + rowBytes, bits);
+    } else {
+        printBitRanges("Mismatched outputs (pin)", pins, 32);
+    }
+    if (map[len - 1] & 1) {
+        printf("Mismatched UES\n");
+    }
+    if (map[len - 1] & 2) {
+        printf("Mismatched CFG\n");
+    }
+}
+
+// Reads the verify result up to the prompt and prints it when the verification failed.
+// Returns 0 when the verification passed, -1 otherwise.
+static char readVerifyResult(int maxDelay) {
+    char line[MAX_LINE];
+    char text[MAX_LINE];
+    int textLen = 0;
+    char result = 0;
+
+    while (1) {
+        int len = readSerialLine(line, sizeof(line), maxDelay);
+        if (len <= 0) {
+            result = -1;
+            break;
+        }
+        if (0 == strcmp(line, ">")) {
+            break;
+        }
+        if (0 == strncmp(line, "OK bin map ", 11)) {
+            printVerifyMap(line + 11);
+            continue;
+        }
+        if (line[0] == 'E' && line[1] == 'R') {
+            result = -1;
+        }
+        if (textLen + len + 2 < MAX_LINE) {
+            textLen += snprintf(text + textLen, MAX_LINE - textLen, "%s\n", line);
+        }
+    }
+    text[textLen] = 0;
+    if (verbose) {
+        printf("read: '%s'\n", text);
+    }
+    if (result) {
+        printf("%s", text);
+    }
+    return result;
+}
+
+// Verifies the GAL without uploading the fuse map: the expected fuse rows are streamed
+// in binary frames and the programmer compares them with the rows read from the GAL.
+// A row frame holds the fuses (row + rows * bit), the rest of the fuses including the APD
+// fuse slot follow in one frame.
+// Returns 0 on success, 1 when the programmer refused the streamed verify, -1 on error.
+static char verifyFrames(void) {
+    char buf[MAX_LINE];
+    unsigned char row[FRAME_ROW_PAYLOAD];
+    unsigned char* frames;
+    int* frameAddr;
+    int* frameSize;
+    int rows = galinfo[gal].rows;
+    int bits = galinfo[gal].bits;
+    int tailBase = rows * bits;
+    int totalFuses = galinfo[gal].fuses + 1;
+    int window = 0;
+    int maxPayload = 0;
+    int count = 0;
+    int i, j;
+    char result;
+
+    // set the GAL type, keep the resident fuse map
+    sprintf(buf, "uk\r");
+    sendLine(buf, MAX_LINE, 20);
+    sprintf(buf, "#t %c %s\r", '0' + (int) gal, galinfo[gal].name);
+    sendLine(buf, MAX_LINE, 300);
+    sprintf(buf, "#e\r");
+    sendLine(buf, MAX_LINE, 300);
+
+    sendBuffer(verifyMap ? "vsm\r" : "vs\r");
+    readSerialLine(buf, sizeof(buf), 2000);
+    if (strncmp(buf, "OK bin verify ", 14) != 0 || sscanf(buf + 14, "%d %d", &window, &maxPayload) != 2 || window < 1 ||
+        maxPayload < (bits + 7) / 8 || maxPayload < (totalFuses - tailBase + 7) / 8) {
+        if (verbose) {
+            printf("binary verify refused: '%s'\n", buf);
+        }
+        waitForSerialPrompt(buf, MAX_LINE, 300);
+        return 1;
+    }
+    if (verbose) {
+        printf("binary verify: window=%d payload=%d\n", window, maxPayload);
+    }
+
+    frames = malloc((rows + 2) * FRAME_ROW_SIZE);
+    frameAddr = malloc((rows + 2) * sizeof(int));
+    frameSize = malloc((rows + 2) * sizeof(int));
+    for (count = 0; count < rows; count++) {
+        memset(row, 0, sizeof(row));
+        for (i = 0; i < bits; i++) {
+            if (fusemap[count + rows * i]) {
+                row[i >> 3] |= (1 << (i & 7));
+            }
+        }
+        frameAddr[count] = count * bits;
+        frameSize[count] = buildFrame(frames + count * FRAME_ROW_SIZE, count, FRAME_ADDR_ROW | count, row, (bits + 7) / 8);
+    }
+    // UES, CFG and the APD fuse slot
+    memset(row, 0, sizeof(row));
+    for (i = tailBase, j = 0; i < totalFuses; i++, j++) {
+        if (fusemap[i]) {
+            row[j >> 3] |= (1 << (j & 7));
+        }
+    }
+    frameAddr[count] = tailBase;
+    frameSize[count] = buildFrame(frames + count * FRAME_ROW_SIZE, count, tailBase, row, (j + 7) / 8);
+    count++;
+    // end of transfer
+    frameAddr[count] = totalFuses;
+    frameSize[count] = buildFrame(frames + count * FRAME_ROW_SIZE, count, totalFuses, row, 0);
+    count++;
+
+    printf("Verifying fuse map...\n");
+    result = sendFrames(frames, FRAME_ROW_SIZE, frameSize, frameAddr, count, window, totalFuses);
+    free(frames);
+    free(frameAddr);
+    free(frameSize);
+
+    if (readVerifyResult(2000)) {
+        result = -1;
+    }
+    return result;
+}
+
+// Upload fusemap in byte format (as opposed to bit format used in JEDEC file).
+static char upload() {
+    char fuseSet;
+    char* buf = malloc(MAX_LINE);
+    char line[64];
+    int i, j;
+    unsigned short csum;
+    int apdFuse = flagEnableApd;
+    int totalFuses = galinfo[gal].fuses;
+
+    if (apdFuse) {
+        totalFuses++;
+    }
+
+    // delta upload, falls back to full upload when not possible
+    if (binUpload && deltaUpload) {
+        char result = uploadDelta(checkSum(totalFuses));
+        if (result <= 0) {
+            free(buf);
+            return result;
+        }
+    }
+
+    // Start  upload
+    sprintf(buf, "u\r");
+    sendLine(buf, MAX_LINE, 20);
+
+    //device type
+    sprintf(buf, "#t %c %s\r", '0' + (int) gal, galinfo[gal].name);
+    sendLine(buf, MAX_LINE, 300);
+
+    //fuse map
+    buf[0] = 0;
+    fuseSet = 0;
+
+    // binary upload, falls back to text upload when refused by the programmer
+    if (binUpload) {
+        char result = uploadFrames(totalFuses, NULL, 0, 0);
+        if (result < 0) {
+            free(buf);
+            return result;
+        }
+        if (result == 0) {
+            goto upload_checksum;
+        }
+    }
+
+    printf("Uploading fuse map...\n");
+    for (i = 0; i < totalFuses;) {
+        unsigned char f = 0;
+        if (i % 32 == 0) {
+            if (i != 0) {
+                strcat(buf, "\r");
+                //the buffer contains at least one fuse set to 1
+                if (fuseSet) {
+#ifdef DEBUG_UPLOAD
+                    printf("%s\n", buf);
+#endif
+                    sendLine(buf, MAX_LINE, 100);
+                    buf[0] = 0;
+                }
+                fuseSet = 0;
+            }
+            sprintf(buf, "#f %04i ", i);
+        }
+        f = 0;
+        for (j = 0; j < 8 && i < totalFuses; j++,i++) {
+            if (fusemap[i]) {
+                f |= (1 << j);
+                fuseSet = 1;
+            }
+        }
+
+        sprintf(line, "%02X", f);
+        strcat(buf, line);
+
+        updateProgressBar("", i, totalFuses);
+    }
+    updateProgressBar("", totalFuses, totalFuses);
+
+    // send last unfinished fuse line
+    if (fuseSet) {
+        strcat(buf, "\r");
+#ifdef DEBUG_UPLOAD
+        printf("%s\n", buf);
+#endif
+        sendLine(buf, MAX_LINE, 100);
+    }
+
+upload_checksum:
+    //checksum
+    csum = checkSum(totalFuses);
+    if (verbose) {
+        printf("sending csum: %04X\n", csum);
+    }
+    sprintf(buf, "#c %04X\r", csum);
+    sendLine(buf, MAX_LINE, 300);
+
+    free(buf);
+    //end of upload
+    return sendGenericCommand("#e\r", "Upload failed", 300, 0); 
+
+}
+
+//returns 0 on success
+static char sendGenericCommand(const char* command, const char* errorText, int maxDelay, char printResult) {
+    char buf[MAX_LINE];
+    int readSize;
+
+    sprintf(buf, "%s", command);
+    readSize = sendLine(buf, MAX_LINE, maxDelay);
+    if (readSize < 0)  {
+        if (verbose) {
+            printf("%s\n", errorText);
+        }
+        return -1;
+    } else {
+        char* response = stripPrompt(buf);
+        char* lastLine = findLastLine(response);
+        if (lastLine == 0 || (lastLine[0] == 'E' && lastLine[1] == 'R')) {
+            printf("%s\n", response);
+            return -1;
+        } else if (printResult && printSerialWhileWaiting == 0) {
+            printf("%s\n", response);
+        }
+    }
+    return 0;
+}
+
+// Returns the JOB_* flags of the requested operations or 0 when the job can not be used.
+// The job uses the fixed programming pulses: the adaptive pulse caps need separate commands.
+static int jobFlags(void) {
+    int flags = JOB_WRITE;
+
+    if (!jobCommand || !opWrite || pulseCap || erasePulseCap || flagEraseAll) {
+        return 0;
+    }
+    if (opVerify) {
+        flags |= JOB_VERIFY;
+    }
+    if (opErase) {
+        flags |= JOB_ERASE;
+        if (blankCheck && !flagNoBlankCheck) {
+            flags |= JOB_SKIP_BLANK;
+        }
+    }
+    if (opSecureGal) {
+        flags |= JOB_SECURE;
+    }
+    return flags;
+}
+
+static char operationWriteOrVerify(char doWrite) {
+
+    char result;
+
+    if (readFile(NULL)) {
+        return -1;
+    }
+
+    result = parseFuseMap(galbuffer);
+    if (verbose) {
+        printf("parse result=%i\n", result);
+    }
+
+    if (openSerial() != 0) {
+        return -1;
+    }
+
+    // set power-down fuse bit (do it before upload to correctly calculate check-sum)
+    result = sendGenericCommand(flagEnableApd ? "z\r" : "Z\r", "APD set failed ?", 4000, 0);
+    if (result) {
+        goto finish;
+    }
+
+    // verify only: stream the expected fuse rows instead of uploading the fuse map
+    if (!doWrite && opVerify && binVerify && gal != GAL6001 && gal != GAL6002) {
+        result = verifyFrames();
+        if (result <= 0) {
+            goto finish;
+        }
+    }
+
+    result = upload();
+    if (result) {
+        return result;
+    }
+
+    // erase, write, verify and secure in one job, the job prints the stage results
+    if (doWrite && jobFlags()) {
+        char cmd[8];
+        sprintf(cmd, "x%02X\r", jobFlags());
+        result = sendGenericCommand(cmd, "job failed ?", 40000, verbose);
+        goto finish;
+    }
+
+    // write command, the write and verify are done in one command when supported
+    if (doWrite) {
+        char cmd[8];
+        char verifyRows = (opVerify && writeVerify) ? 1 : 0;
+        if (pulseCap && adaptiveProg) {
+            // the per-row pulse counts are printed in verbose mode
+            sprintf(cmd, "w%sa%i\r", verifyRows ? "v" : "", pulseCap);
+            result = sendGenericCommand(cmd, "write failed ?", 30000, verbose);
+        } else if (verifyRows) {
+            result = sendGenericCommand("wv\r", "write failed ?", 16000, 0);
+        } else {
+            result = sendGenericCommand("w\r", "write failed ?", 8000, 0);
+        }
+        if (result) {
+            goto finish;
+        }
+    }
+
+    // verify command
+    if (opVerify && !(doWrite && writeVerify)) {
+        if (verifyMap) {
+            result = sendBuffer("vm\r") ? -1 : readVerifyResult(8000);
+        } else {
+            result = sendGenericCommand("v\r", "verify failed ?", 8000, 0);
+        }
+    }
+finish:
+    closeSerial();
+    return result;
 }
 
 
@@ -1165,34 +2104,274 @@ static char operationWritePes(void) {
     return result;
 }
 
+// Returns 1 when the GAL is blank, 0 when a programmed fuse was found, -1 on error.
+static char checkGalBlank(void) {
+    char buf[MAX_LINE];
+    char* response;
+    char* lastLine;
+
+    sprintf(buf, "k\r");
+    if (sendLine(buf, MAX_LINE, 4000) < 0) {
+        return -1;
+    }
+    response = stripPrompt(buf);
+    lastLine = findLastLine(response);
+    if (lastLine == 0) {
+        return -1;
+    }
+    if (strncmp(lastLine, "OK blank", 8) == 0) {
+        return 1;
+    }
+    if (strncmp(lastLine, "ER not blank", 12) == 0) {
+        if (verbose) {
+            printf("%s\n", lastLine);
+        }
+        return 0;
+    }
+    printf("%s\n", response);
+    return -1;
+}
+
 static char operationEraseGal(void) {
     char* buf = malloc(MAX_LINE);
     char result;
 
-    if (openSerial() != 0) {
-        return -1;
+    if (openSerial() != 0) {
+        return -1;
+    }
+
+    //Switch to upload mode to specify GAL
+    sprintf(buf, "u\r");
+    sendLine(buf, MAX_LINE, 300);
+
+    //set GAL type
+    sprintf(buf, "#t %c\r", '0' + (int) gal);
+    sendLine(buf, MAX_LINE, 300);
+
+    //Exit upload mode (ensure the return texts are discarded by waiting 100 ms)
+    sprintf(buf, "#e\r");
+    sendLine(buf, MAX_LINE, 100);
+
+    // skip the erase of blank chips, erase all always clears the PES
+    if (blankCheck && !flagEraseAll && !flagNoBlankCheck && gal != GAL6001 && gal != GAL6002) {
+        result = checkGalBlank();
+        if (result == 1) {
+            printf("GAL is blank, erase skipped\n");
+            free(buf);
+            closeSerial();
+            return 0;
+        }
+        // not blank or the check failed: erase
+    }
+
+    if (erasePulseCap && adaptiveErase) {
+        // the firmware reports the number of erase pulses
+        sprintf(buf, "%ca%i\r", flagEraseAll ? '~' : 'c', erasePulseCap);
+        result = sendGenericCommand(buf, "erase failed ?", 30000, 1);
+    } else if (flagEraseAll) {
+        result = sendGenericCommand("~\r", "erase all failed ?", 4000, 0);
+    } else {
+        result = sendGenericCommand("c\r", "erase failed ?", 4000, 0);
+    }
+    free(buf);
+    closeSerial();
+    return result;
+}
+
+// Prints a block of fuse rows in the JEDEC form, the rows with all fuses 0 are skipped.
+// The output matches the JEDEC text printed by the programmer.
+static int printJedecBlock(int k, int bits, int rows) {
+    int i, j;
+
+    for (i = 0; i < bits; i++) {
+        char unused = 1;
+        for (j = 0; j < rows; j++) {
+            unused &= !fusemap[k + j];
+        }
+        if (unused) {
+            k += rows;
+            continue;
+        }
+        printf("L%04d ", k);
+        for (j = 0; j < rows; j++, k++) {
+            putchar(fusemap[k] ? '1' : '0');
+        }
+        printf("*\r\n");
+    }
+    return k;
+}
+
+// Prints the fuse map read in binary frames as the JEDEC text the programmer prints
+// for the 'r' command. 'pes' is the PES in hex digits, 'totalFuses' includes the APD fuse.
+static void printJedec(const char* name, const char* pes, int totalFuses) {
+    int fuses = galinfo[gal].fuses;
+    int apdFuse = totalFuses > fuses;
+    int i, j, k;
+
+    printf("JEDEC file for %s\r\n", name);
+    printf("*QP%d*QF%d*QV0*F0*G0*X0*\r\n", galinfo[gal].pins, totalFuses);
+
+    k = 0;
+    if (gal == GAL6001 || gal == GAL6002) {
+        k = printJedecBlock(k, 64, 114);
+        k = printJedecBlock(k, 11, 78);
+    } else {
+        k = printJedecBlock(k, galinfo[gal].bits, galinfo[gal].rows);
+    }
+    if (k < galinfo[gal].uesfuse) {
+        printf("L%04d ", k);
+        while (k < galinfo[gal].uesfuse) {
+            putchar(fusemap[k++] ? '1' : '0');
+        }
+        printf("*\r\n");
+    }
+
+    // UES in byte form
+    printf("N UES");
+    for (j = 0; j < galinfo[gal].uesbytes; j++) {
+        int n = 0;
+        for (i = 0; i < 8; i++) {
+            if (fusemap[k + 8 * j + i]) {
+                n |= (gal == ATF22V10C || gal == ATF750C) ? 1 << (7 - i) : 1 << i;
+            }
+        }
+        printf(" %02X", n);
+    }
+    printf("*\r\n");
+
+    // UES in bit form
+    printf("L%04d ", k);
+    for (j = 0; j < 8 * galinfo[gal].uesbytes; j++) {
+        putchar(fusemap[k++] ? '1' : '0');
+    }
+    printf("*\r\n");
+
+    // CFG bits
+    if (k < fuses) {
+        printf("L%04d ", k);
+        while (k < fuses) {
+            putchar(fusemap[k++] ? '1' : '0');
+        }
+        printf("%s*\r\n", apdFuse ? "1" : "");
+    } else if (apdFuse) {
+        printf("L%04d 1*\r\n", k);
+    }
+
+    printf("N PES");
+    for (i = 0; pes[i] && pes[i + 1]; i += 2) {
+        printf(" %c%c", pes[i], pes[i + 1]);
+    }
+    printf("*\r\n");
+    printf("C%04X\r\n", checkSum(totalFuses));
+    printf("*\n");
+}
+
+// Reads the fuse map in binary frames and prints it in the JEDEC form.
+// 'cmd' is 'b' to send the fuse map after it is read or 's' to stream the fuse rows while reading.
+// The streamed fuse rows are placed back into the fuse map (fuse = row + rows * bit).
+// Returns 0 on success, -1 on error, 1 when the binary read failed and the text read should be used.
+static char readFusesBinary(char cmd) {
+    char* buf = galbuffer;
+    char line[MAX_LINE];
+    char text[MAX_LINE];
+    unsigned char frame[FRAME_HEADER_SIZE + FRAME_READ_PAYLOAD + FRAME_CRC_SIZE];
+    char pes[64];
+    char name[64];
+    int textLen = 0;
+    int totalFuses;
+    int seq = 0;
+    int addr = 0;
+    int row = 0;
+
+    sprintf(buf, "r%c\r", cmd);
+    if (sendBuffer(buf)) {
+        return -1;
+    }
+
+    // the messages preceding the binary data are printed as they are
+    while (1) {
+        int len = readSerialLine(line, sizeof(line), 12000);
+        if (len <= 0) {
+            return -1;
+        }
+        if (0 == strncmp(line, "OK bin read ", 12)) {
+            break;
+        }
+        if (0 == strcmp(line, ">")) {
+            // the command has finished without the binary data (type check failed)
+            text[textLen] = 0;
+            printf("%s\n", stripPrompt(text));
+            return (text[0] == 'E' && text[1] == 'R') ? -1 : 1;
+        }
+        if (textLen + len + 3 < MAX_LINE) {
+            textLen += snprintf(text + textLen, MAX_LINE - textLen, "%s\r\n", line);
+        }
+    }
+    if (3 != sscanf(line + 12, "%d %63s %63s", &totalFuses, pes, name) || totalFuses <= 0 || totalFuses >= MAXFUSES) {
+        waitForSerialPrompt(buf, GALBUFSIZE, 2000);
+        return 1;
+    }
+
+    memset(fusemap, 0, sizeof(fusemap));
+    while (1) {
+        unsigned short crc;
+        int len, i, frameAddr;
+
+        if (readSerialBytes((char*) frame, 1, 2000) != 1 || frame[0] > FRAME_READ_PAYLOAD) {
+            break;
+        }
+        len = frame[0];
+        if (readSerialBytes((char*) frame + 1, FRAME_HEADER_SIZE - 1 + len + FRAME_CRC_SIZE, 2000) != FRAME_HEADER_SIZE - 1 + len + FRAME_CRC_SIZE) {
+            break;
+        }
+        crc = crc16(0xFFFF, frame, FRAME_HEADER_SIZE + len);
+        frameAddr = frame[2] | (frame[3] << 8);
+        if (frame[FRAME_HEADER_SIZE + len] != (crc & 0xFF) || frame[FRAME_HEADER_SIZE + len + 1] != (crc >> 8) ||
+            frame[1] != (seq & 0xFF)) {
+            break;
+        }
+        if (len == 0) {
+            // the end frame holds the total fuse count, the streamed one includes the APD fuse
+            if (frameAddr < totalFuses || frameAddr > totalFuses + 1 || addr < frameAddr) {
+                break;
+            }
+            waitForSerialPrompt(buf, GALBUFSIZE, 2000);
+            text[textLen] = 0;
+            printf("%s", text);
+            printJedec(name, pes, frameAddr);
+            return 0;
+        }
+        if (frameAddr & FRAME_ADDR_ROW) {
+            int rows = galinfo[gal].rows;
+            int bits = galinfo[gal].bits;
+
+            if ((frameAddr & ~FRAME_ADDR_ROW) != row || row >= rows || addr > 0 || len * 8 < bits) {
+                break;
+            }
+            for (i = 0; i < bits; i++) {
+                fusemap[row + rows * i] = (frame[FRAME_HEADER_SIZE + (i >> 3)] >> (i & 7)) & 1;
+            }
+            // the rest of the fuses follow the last row
+            if (++row == rows) {
+                addr = rows * bits;
+            }
+        } else {
+            if (frameAddr != addr) {
+                break;
+            }
+            for (i = 0; i < len * 8 && addr <= totalFuses; i++, addr++) {
+                fusemap[addr] = (frame[FRAME_HEADER_SIZE + (i >> 3)] >> (i & 7)) & 1;
+            }
+        }
+        seq++;
     }
 
-    //Switch to upload mode to specify GAL
-    sprintf(buf, "u\r");
-    sendLine(buf, MAX_LINE, 300);
-
-    //set GAL type
-    sprintf(buf, "#t %c\r", '0' + (int) gal);
-    sendLine(buf, MAX_LINE, 300);
-
-    //Exit upload mode (ensure the return texts are discarded by waiting 100 ms)
-    sprintf(buf, "#e\r");
-    sendLine(buf, MAX_LINE, 100);
-
-    if (flagEraseAll) {
-        result = sendGenericCommand("~\r", "erase all failed ?", 4000, 0);
-    } else {
-        result = sendGenericCommand("c\r", "erase failed ?", 4000, 0);
+    // corrupted transfer: skip the rest of the data
+    if (verbose) {
+        printf("binary read failed at fuse %d\n", addr);
     }
-    free(buf);
-    closeSerial();
-    return result;
+    waitForSerialPrompt(buf, GALBUFSIZE, 2000);
+    return 1;
 }
 
 static char operationReadFuses(void) {
@@ -1216,6 +2395,14 @@ static char operationReadFuses(void) {
     sprintf(buf, "#e\r");
     sendLine(buf, MAX_LINE, 1000);
 
+    if (binRead || binStream) {
+        char result = readFusesBinary(binStream ? 's' : 'b');
+        if (result <= 0) {
+            closeSerial();
+            return result;
+        }
+    }
+
     //READ_FUSE command
     sprintf(buf, "r\r");
     readSize = sendLine(buf, GALBUFSIZE, 12000);
@@ -1235,74 +2422,117 @@ static char operationReadFuses(void) {
 }
 
 
+// Reads a line sent by the JTAG player directly from the receive ring buffer.
+// A feed request "$NNN\r\n" might interrupt a message line: the text before the feed
+// request is returned and the rest of the message follows in the next line.
+// Partially received lines and feed requests are completed before returning.
+// Returns the length of the text, plus 2 if the line ended normally, -1 on error.
 static int readJtagSerialLine(char* buf, int bufSize, int maxDelay, int* feedRequest) {
-    char* bufStart = buf;
-    int readSize;
-    int bufPos = 0;
+    long long deadline = getTimeMs() + maxDelay;
+    int len = 0;
 
-    memset(buf, 0, bufSize);
+    buf[0] = 0;
 
-    while (maxDelay > 0) {
-        readSize = serialDeviceRead(serialF, buf, 1);
-        if (readSize > 0) {
-            bufPos += readSize;
-            buf[1] = 0;
-            //handle the feed request
-            if (buf[0] == '$') {
-                char tmp[5];
-                bufPos -= readSize;
-                buf[0] = 0;
-                //extra 5 bytes should be present: 3 bytes of size, 2 new line chars
-                readSize = serialDeviceRead(serialF, tmp, 3);
-                if (readSize == 3) {
-                    int retry = 1000;
-                    tmp[3] = 0;
-                    *feedRequest = atoi(tmp);
-                    maxDelay = 0; //force exit
-
-                    //read the extra 2 characters (new line chars)
-                    while (retry && readSize != 2) {
-                        readSize = serialDeviceRead(serialF, tmp, 2);
-                        retry--;
-                    }
-                    if (readSize != 2 || tmp[0] != '\r' || tmp[1] != '\n') {
-                        printf("Warning: corrupted feed request ! %d \n", readSize);
-                    }
-                } else {
-                    printf("Warning: corrupted feed request! %d \n", readSize);
+    while (1) {
+        unsigned int available = SERIAL_RX_AVAILABLE();
+
+        while (available > 0) {
+            char c = SERIAL_RX_PEEK(0);
+
+            // feed request: '$', 3 digits of size, 2 new line chars
+            if (c == '$') {
+                char req[4];
+                int i;
+                if (available < 6) {
+                    break; // wait for the rest of the request
                 }
-                //printf("***\n");
-            } else
-            if (buf[0] == '\r') {
-                readSize = serialDeviceRead(serialF, buf, 1); // read \n coming from Arduino
-                //printf("-%c-\n", buf[0] == '\n' ? 'n' : 'r');
-                buf[0] = 0;
-                bufPos++;
-                maxDelay = 0; //force exit
-            } else {
-                //printf("(0x%02x %d) \n", buf[0], (int) buf[0]);
-                buf += readSize;
-                if (bufPos == bufSize) {
-                    printf("ERROR: serial port read buffer is too small!\nAre you dumping large amount of data?\n");
-                    return -1;
+                for (i = 0; i < 3; i++) {
+                    req[i] = SERIAL_RX_PEEK(i + 1);
+                }
+                req[3] = 0;
+                if (!isdigit(req[0]) || !isdigit(req[1]) || !isdigit(req[2]) ||
+                    SERIAL_RX_PEEK(4) != '\r' || SERIAL_RX_PEEK(5) != '\n') {
+                    printf("Warning: corrupted feed request!\n");
+                }
+                serialRxStart += 6;
+                *feedRequest = atoi(req);
+                buf[len] = 0;
+                return len;
+            }
+            serialRxStart++;
+            available--;
+            if (c == '\n') {
+                //strip the new line characters
+                if (len > 0 && buf[len - 1] == '\r') {
+                    len--;
                 }
+                buf[len] = 0;
+                return len + 2;
             }
+            if (len >= bufSize - 1) {
+                printf("ERROR: serial port read buffer is too small!\nAre you dumping large amount of data?\n");
+                return -1;
+            }
+            buf[len++] = c;
         }
-        if (maxDelay > 0) {
-        /* WIN_API handles timeout itself */
-#ifndef _USE_WIN_API_
-            usleep(1 * 1000);
-            maxDelay -= 10;
-#else
-            maxDelay -= 30;
-#endif
+
+        maxDelay = (int) (deadline - getTimeMs());
+        if (maxDelay <= 0 || serialReceive(maxDelay) < 0) {
+            buf[len] = 0;
+            return len;
         }
     }
-    return bufPos;
+}
+
+// Compresses the XSVF data for the JTAG player (LZSS, greedy matching).
+// Each group of 8 items is preceded by a flag byte, LSB first. Flag 0: literal byte,
+// flag 1: match of 2 bytes - distance - 1 and length - 3.
+// The dst buffer must have space for size * 9 / 8 + 1 bytes. Returns the compressed size.
+static int compressXsvf(const unsigned char* src, int size, unsigned char* dst) {
+    int pos = 0;
+    int dstPos = 0;
+    int flagPos = 0;
+    int items = 0;
+
+    while (pos < size) {
+        int bestLen = 0;
+        int bestDist = 0;
+        int dist;
+
+        // start a new group
+        if ((items & 7) == 0) {
+            flagPos = dstPos++;
+            dst[flagPos] = 0;
+        }
+        for (dist = 1; dist <= XSVF_LZ_WINDOW && dist <= pos; dist++) {
+            int len = 0;
+            while (pos + len < size && len < XSVF_LZ_MAX_MATCH && src[pos + len] == src[pos + len - dist]) {
+                len++;
+            }
+            if (len > bestLen) {
+                bestLen = len;
+                bestDist = dist;
+            }
+        }
+        if (bestLen >= XSVF_LZ_MIN_MATCH) {
+            dst[flagPos] |= 1 << (items & 7);
+            dst[dstPos++] = (unsigned char) (bestDist - 1);
+            dst[dstPos++] = (unsigned char) (bestLen - XSVF_LZ_MIN_MATCH);
+            pos += bestLen;
+        } else {
+            dst[dstPos++] = src[pos++];
+        }
+        items++;
+    }
+    return dstPos;
 }
 
 static int playJtagFile(char* label, int fSize, int vpp, int showProgress) {
     char buf[MAX_LINE] = {0};
+    unsigned char* lzData = NULL;
+    int lzSize = 0;
+    char* data = galbuffer; // data being sent: plain or compressed
+    int dataSize = fSize;
     int sendPos = 0;
     int lastSendPos = 0;
     char ready = 0;
@@ -1323,8 +2553,16 @@ static int playJtagFile(char* label, int fSize, int vpp, int showProgress) {
         }
     }
 
-    // send start-JTAG-player command
-    sprintf(buf, "j%d\r", vpp ? 1: 0);
+    // compressed data are sent only when the MCU confirms it can decompress them
+    if (!noXsvfCompress) {
+        lzData = (unsigned char*) malloc(fSize + fSize / 8 + 1);
+        if (lzData != NULL) {
+            lzSize = compressXsvf((unsigned char*) galbuffer, fSize, lzData);
+        }
+    }
+
+    // send start-JTAG-player command, 'z': request the compressed stream
+    sprintf(buf, "j%d%s\r", vpp ? 1: 0, lzData ? "z" : "");
     sendBuffer(buf);
 
     // read response from MCU and feed the XSVF player with data
@@ -1335,29 +2573,37 @@ static int playJtagFile(char* label, int fSize, int vpp, int showProgress) {
         buf[0] = 0;
         readBytes = readJtagSerialLine(buf, MAX_LINE, 3000, &feedRequest);
         //printf(">> read %d  len=%d cp=%d '%s'\n", readBytes, (int) strlen(buf), continuePrinting,  buf);
+        if (readBytes < 0) {
+            result = -1;
+            break;
+        }
 
-        //request to send more data was received
+        // request to send more data was received: the MCU grants the free space
+        // of its receive buffer ahead of consumption, so several chunks can be in flight
         if (feedRequest > 0) {
             if (ready) {
-                int chunkSize = fSize - sendPos;
+                int chunkSize = dataSize - sendPos;
                 if (chunkSize > feedRequest) {
                     chunkSize = feedRequest;
-                    // make the initial chunk big so the data are buffered by the OS
+                    // the initial chunk is sent twice as big, the MCU reserves space for it
                     if (sendPos == 0) {
                         chunkSize *= 2;
-                        if (chunkSize > fSize) {
-                            chunkSize = fSize;
+                        if (chunkSize > dataSize) {
+                            chunkSize = dataSize;
                         }
                     }
                 }
                 if (chunkSize > 0) {
                     // send the data over serial line
-                    int w = serialDeviceWrite(serialF, galbuffer + sendPos, chunkSize);
-                    sendPos += w;
+                    if (sendBytes(data + sendPos, chunkSize)) {
+                        result = -1;
+                        break;
+                    }
+                    sendPos += chunkSize;
                     // print progress / file position
-                    if (showProgress && (sendPos - lastSendPos >= 1024 || sendPos == fSize)) {
+                    if (showProgress && (sendPos - lastSendPos >= 1024 || sendPos == dataSize)) {
                         lastSendPos = sendPos;
-                        updateProgressBar(label, sendPos, fSize);
+                        updateProgressBar(label, sendPos, dataSize);
                     }
                }
             }
@@ -1397,6 +2643,15 @@ static int playJtagFile(char* label, int fSize, int vpp, int showProgress) {
             if (strcmp("RXSVF", buf) == 0) {
                 ready = 1;
             } else
+            // ready to receive compressed stream
+            if (strcmp("RXSVFZ", buf) == 0 && lzData != NULL) {
+                ready = 1;
+                data = (char*) lzData;
+                dataSize = lzSize;
+                if (verbose) {
+                    printf("XSVF compressed: %d -> %d bytes\n", fSize, lzSize);
+                }
+            } else
             // print important messages
             if (buf[0] == '!') {
                 // in verbose mode print all messages, otherwise print only success or fail messages
@@ -1420,6 +2675,7 @@ static int playJtagFile(char* label, int fSize, int vpp, int showProgress) {
 
     readJtagSerialLine(buf, MAX_LINE, 1000, &feedRequest);
     closeSerial();
+    free(lzData);
     return result;
 }
 
@@ -1527,21 +2783,26 @@ static int processJtag(void) {
     return 0;
 }
 
-int main(int argc, char** argv) {
-    char result = 0;
+// starts or ends the power session: the programmer keeps the GAL powered between the commands
+static char operationPowerSession(char on) {
+    char result;
 
-    result = checkArgs(argc, argv);
-    if (result) {
-        return result;
-    }
-    if (verbose) {
-        printf("Afterburner " VERSION " \n");
+    if (openSerial() != 0) {
+        return -1;
     }
+    result = sendGenericCommand(on ? "o\r" : "o0\r", "power session failed ?", 4000, 0);
+    closeSerial();
+    return result;
+}
+
+// runs the operations requested on the command line
+static char runOperations(void) {
+    char result = 0;
+    char session = 0;
 
     // process JTAG operations
     if (gal != 0 && galinfo[gal].id0 == JTAG_ID && galinfo[gal].id1 == JTAG_ID) {
-        result = processJtag();
-        goto finish;
+        return processJtag();
     }
 
     result = operationSetGalCheck();
@@ -1550,7 +2811,14 @@ int main(int argc, char** argv) {
         result = operationSetGalType(gal);
     }
 
-    if (opErase && 0 == result) {
+    // keep the GAL powered between the operations, the PES check and the erase.
+    // Only the daemon keeps the serial port open: reopening it resets the programmer.
+    if (daemonMode && gal != UNKNOWN && 0 == result && powerSession && (opErase || opWrite || opVerify || opRead)) {
+        session = (operationPowerSession(1) == 0) ? 1 : 0;
+    }
+
+    // the erase is a stage of the job
+    if (opErase && 0 == result && !jobFlags()) {
         result = operationEraseGal();
     }
 
@@ -1570,7 +2838,7 @@ int main(int argc, char** argv) {
         } else if (opWritePes) {
             result = operationWritePes();
         }
-        if (0 == result && (opWrite || opVerify)) {
+        if (0 == result && (opWrite || opVerify) && !jobFlags()) {
             if (opSecureGal) {
                 operationSecureGal();
             }
@@ -1585,8 +2853,422 @@ int main(int argc, char** argv) {
             }
         }
     }
+    // the VPP functions end the session on the programmer as well
+    if (session) {
+        operationPowerSession(0);
+    }
+    return result;
+}
+
+#ifndef _USE_WIN_API_
+
+/*
+ Daemon mode: the daemon opens the serial connection once and keeps it open.
+ Other afterburner invocations connect to its local socket and send a request:
+    <current directory> \0 <arg 1> \0 ... <arg N> \0
+ then shut down the write side of the socket. The daemon runs the operations
+ in the client's directory and streams the text output back. The output ends
+ with \0 followed by a single byte with the result code.
+*/
+
+static volatile sig_atomic_t daemonQuit = 0;
+
+static void daemonSignalHandler(int sig) {
+    (void) sig;
+    daemonQuit = 1;
+}
+
+// sets the per-user socket path unless it was passed by -sock option
+static void setDaemonSocketPath(void) {
+    static char path[sizeof(((struct sockaddr_un*) 0)->sun_path)];
+    char* dir = getenv("XDG_RUNTIME_DIR");
+
+    if (daemonSocketPath != NULL) {
+        return;
+    }
+    if (dir != NULL && dir[0] == '/') {
+        snprintf(path, sizeof(path), "%s/" DAEMON_SOCKET_NAME ".sock", dir);
+    } else {
+        snprintf(path, sizeof(path), "/tmp/" DAEMON_SOCKET_NAME "-%u.sock", (unsigned) getuid());
+    }
+    daemonSocketPath = path;
+}
+
+// returns 1 when the socket exists and belongs to the current user
+static char isOwnSocket(void) {
+    struct stat st;
+
+    if (lstat(daemonSocketPath, &st) != 0) {
+        return 0;
+    }
+    return S_ISSOCK(st.st_mode) && st.st_uid == getuid();
+}
+
+// resets the command line state before the next job
+static void resetArgs(void) {
+    verbose = 0;
+    filename = 0;
+    pesString = NULL;
+    gal = UNKNOWN;
+    security = 0;
+    noGalCheck = 0;
+    noXsvfCompress = 0;
+    printSerialWhileWaiting = 0;
+    calOffset = 0;
+    opRead = opWrite = opErase = opInfo = opVerify = 0;
+    opTestVPP = opCalibrateVPP = opMeasureVPP = opSecureGal = opWritePes = 0;
+    flagEnableApd = 0;
+    flagEraseAll = 0;
+    flagNoBlankCheck = 0;
+    pulseCap = 0;
+    erasePulseCap = 0;
+    memset(fusemap, 0, sizeof(fusemap));
+}
+
+static int connectDaemon(void) {
+    struct sockaddr_un addr;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (fd < 0) {
+        return -1;
+    }
+    // do not pass the job to a daemon run by another user
+    if (!isOwnSocket()) {
+        close(fd);
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", daemonSocketPath);
+    if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int writeAll(int fd, const char* buf, int size) {
+    while (size > 0) {
+        int w = write(fd, buf, size);
+        if (w < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += w;
+        size -= w;
+    }
+    return 0;
+}
+
+// Passes the command line to a running daemon and prints its output.
+// Returns 0 when no daemon is running, otherwise 1 and the result of the operations.
+static char runAsClient(int argc, char** argv, char* opResult) {
+    char buf[4096];
+    char* request;
+    int fd;
+    int i;
+    int size;
+    char done = 0;
+    int result = -1;
+
+    fd = connectDaemon();
+    if (fd < 0) {
+        return 0;
+    }
+
+    request = malloc(DAEMON_MAX_REQUEST);
+    if (NULL == getcwd(request, DAEMON_MAX_REQUEST)) {
+        request[0] = 0;
+    }
+    size = strlen(request) + 1;
+    for (i = 1; i < argc; i++) {
+        int len = strlen(argv[i]) + 1;
+        if (size + len > DAEMON_MAX_REQUEST) {
+            printf("Error: command line is too long\n");
+            free(request);
+            close(fd);
+            *opResult = -1;
+            return 1;
+        }
+        memcpy(request + size, argv[i], len);
+        size += len;
+    }
+    i = writeAll(fd, request, size);
+    free(request);
+    if (i) {
+        printf("Error: failed to send the request to the daemon\n");
+        close(fd);
+        *opResult = -1;
+        return 1;
+    }
+    shutdown(fd, SHUT_WR);
+
+    // print the output until the result code arrives
+    while ((size = read(fd, buf, sizeof(buf))) != 0) {
+        char* end;
+        if (size < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (done) {
+            result = (signed char) buf[0];
+            break;
+        }
+        end = memchr(buf, 0, size);
+        if (end == NULL) {
+            fwrite(buf, 1, size, stdout);
+            fflush(stdout);
+            continue;
+        }
+        fwrite(buf, 1, end - buf, stdout);
+        done = 1;
+        if (end + 1 < buf + size) {
+            result = (signed char) end[1];
+            break;
+        }
+    }
+    fflush(stdout);
+    close(fd);
+    if (result < 0 && !done) {
+        printf("Error: the daemon connection was interrupted\n");
+    }
+    *opResult = (char) result;
+    return 1;
+}
+
+// checks the idle session still works, closes it otherwise
+static void checkSerialSession(void) {
+    char buf[512];
+    int total;
+
+    if (serialF == INVALID_HANDLE) {
+        return;
+    }
+    sendBuffer("*\r");
+    total = waitForSerialPrompt(buf, sizeof(buf), 1000);
+    if (total <= 0 || strstr(buf, "AFTerburner v.") == NULL) {
+        if (verbose) {
+            printf("serial session lost\n");
+        }
+        serialLost = 1;
+        closeSerialSession();
+    }
+}
+
+// runs a single job received from the client socket
+static void daemonHandleJob(int fd) {
+    char* request = malloc(DAEMON_MAX_REQUEST + 1);
+    char* args[256];
+    char cwd[1024];
+    char* savedDeviceName = deviceName;
+    char daemonVerbose = verbose;
+    int savedStdout;
+    int size = 0;
+    int argc = 1;
+    int i;
+    char result;
+
+    // read the whole request
+    while (size < DAEMON_MAX_REQUEST) {
+        int r = read(fd, request + size, DAEMON_MAX_REQUEST - size);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            break;
+        }
+        size += r;
+    }
+    request[size] = 0;
+
+    args[0] = "afterburner";
+    for (i = strlen(request) + 1; i < size && argc < 255; i += strlen(request + i) + 1) {
+        args[argc++] = request + i;
+    }
+    args[argc] = NULL;
+
+    if (NULL == getcwd(cwd, sizeof(cwd))) {
+        cwd[0] = 0;
+    }
+    if (request[0] != 0 && chdir(request) != 0) {
+        printf("Warning: failed to change directory to %s\n", request);
+    }
+
+    // the output of the operations goes to the client
+    fflush(stdout);
+    savedStdout = dup(STDOUT_FILENO);
+    dup2(fd, STDOUT_FILENO);
+
+    resetArgs();
+    result = checkArgs(argc, args);
+    if (0 == result) {
+        if (verbose) {
+            printf("Afterburner " VERSION " (daemon)\n");
+        }
+        // the session might have been closed: reconnect
+        if (serialF == INVALID_HANDLE) {
+            deviceName = savedDeviceName;
+        }
+        result = runOperations();
+        if (verbose) {
+            printf("result=%i\n", (char)result);
+        }
+    }
+    fflush(stdout);
+    dup2(savedStdout, STDOUT_FILENO);
+    close(savedStdout);
+
+    {
+        char trailer[2] = {0, result};
+        writeAll(fd, trailer, 2);
+    }
+
+    if (cwd[0] != 0 && chdir(cwd) != 0) {
+        printf("Warning: failed to restore directory %s\n", cwd);
+    }
+    deviceName = savedDeviceName;
+    verbose = daemonVerbose;
+    if (serialLost) {
+        closeSerialSession();
+    }
+    free(request);
+}
+
+static int runDaemon(void) {
+    struct sockaddr_un addr;
+    struct pollfd p;
+    mode_t mask;
+    int fd;
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        printf("Error: failed to create socket: %s\n", strerror(errno));
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", daemonSocketPath);
+    // remove the socket left by a daemon which is gone, do not take over a running one
+    if (isOwnSocket()) {
+        int other = connectDaemon();
+        if (other >= 0) {
+            printf("Error: another daemon is listening on %s\n", daemonSocketPath);
+            close(other);
+            close(fd);
+            return -1;
+        }
+        if (errno == ECONNREFUSED) {
+            unlink(daemonSocketPath);
+        }
+    }
+    // the socket is accessible by the current user only
+    mask = umask(077);
+    if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0 || chmod(daemonSocketPath, 0600) != 0 || listen(fd, 4) != 0) {
+        printf("Error: failed to listen on %s: %s\n", daemonSocketPath, strerror(errno));
+        umask(mask);
+        close(fd);
+        return -1;
+    }
+    umask(mask);
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, daemonSignalHandler);
+    signal(SIGTERM, daemonSignalHandler);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    if (openSerial() != 0) {
+        printf("Warning: programmer not connected, the connection is retried with the next job\n");
+    }
+    printf("afterburner daemon listening on %s\n", daemonSocketPath);
+
+    while (!daemonQuit) {
+        int r;
+
+        p.fd = fd;
+        p.events = POLLIN;
+        p.revents = 0;
+        r = poll(&p, 1, DAEMON_KEEPALIVE_TIME);
+        if (r < 0 && errno != EINTR) {
+            break;
+        }
+        if (r == 0) {
+            checkSerialSession();
+        } else if (r > 0) {
+            int client = accept(fd, NULL, NULL);
+            if (client >= 0) {
+                daemonHandleJob(client);
+                close(client);
+            }
+        }
+    }
+
+    close(fd);
+    unlink(daemonSocketPath);
+    daemonMode = 0;
+    closeSerialSession();
+    return 0;
+}
+
+#endif /* _USE_WIN_API_ */
+
+int main(int argc, char** argv) {
+    char result = 0;
+    char* progName = strrchr(argv[0], '/');
+    int i;
+
+    // daemon options are handled before the command line is checked
+    progName = (progName == NULL) ? argv[0] : progName + 1;
+    daemonMode = (0 == strcmp(progName, "afterburnerd"));
+    for (i = 1; i < argc; i++) {
+        if (strcmp("-daemon", argv[i]) == 0) {
+            daemonMode = 1;
+        } else if (strcmp("-sock", argv[i]) == 0 && i + 1 < argc) {
+            daemonSocketPath = argv[++i];
+        }
+    }
+
+#ifndef _USE_WIN_API_
+    setDaemonSocketPath();
+    if (daemonMode) {
+        for (i = 1; i < argc; i++) {
+            if (strcmp("-v", argv[i]) == 0) {
+                verbose = 1;
+            } else if (strcmp("-d", argv[i]) == 0 && i + 1 < argc) {
+                deviceName = argv[++i];
+            } else if (strcmp("-speed", argv[i]) == 0) {
+                if (parseSpeed(i + 1 < argc ? argv[++i] : NULL)) {
+                    return -1;
+                }
+            }
+        }
+        return runDaemon();
+    }
+
+    // pass the operations to the running daemon
+    if (runAsClient(argc, argv, &result)) {
+        return result;
+    }
+#else
+    if (daemonMode) {
+        printf("Error: daemon mode is not supported on this platform\n");
+        return -1;
+    }
+#endif
+
+    result = checkArgs(argc, argv);
+    if (result) {
+        return result;
+    }
+    if (verbose) {
+        printf("Afterburner " VERSION " \n");
+    }
+
+    result = runOperations();
 
-finish:
     if (verbose) {
         printf("result=%i\n", (char)result);
     }
@@ -159,6 +159,14 @@ static inline void serialDeviceClose(SerialDeviceHandle deviceHandle) {
 #endif
 }
 
+// closes the device even when NO_CLOSE is defined, the next open creates a new handle
+static inline void serialDeviceDrop(SerialDeviceHandle deviceHandle) {
+#ifdef NO_CLOSE
+    serH = INVALID_HANDLE;
+#endif
+    CloseHandle(deviceHandle);
+}
+
 static inline int serialDeviceWrite(SerialDeviceHandle deviceHandle, char* buffer, int bytesToWrite) {
     DWORD written = 0;
     WriteFile(deviceHandle, buffer, bytesToWrite, &written, NULL);
@@ -171,14 +179,40 @@ static inline int serialDeviceRead(SerialDeviceHandle deviceHandle, char* buffer
     return (int) read;
 }
 
+// ReadFile() handles the timeout itself (see SetCommTimeouts), so just proceed to reading
+static inline int serialDeviceWait(SerialDeviceHandle deviceHandle, int timeoutMs) {
+    return 1;
+}
+
+// returns 0 on success
+static inline int serialDeviceSetSpeed(SerialDeviceHandle deviceHandle, int speed) {
+    DCB dcbSerialParams = { 0 };
+    dcbSerialParams.DCBlength = sizeof(dcbSerialParams);
+
+    FlushFileBuffers(deviceHandle);
+    if (!GetCommState(deviceHandle, &dcbSerialParams)) {
+        return -1;
+    }
+    dcbSerialParams.BaudRate = speed;
+    if (!SetCommState(deviceHandle, &dcbSerialParams)) {
+        return -1;
+    }
+    return 0;
+}
+
 #else
 
 #include <ctype.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <poll.h>
 
 #include <termios.h>
 
+#ifdef _OSX_
+#include <sys/ioctl.h>
+#include <IOKit/serial/ioss.h>
+#endif
 
 #define SerialDeviceHandle int
 #define DEFAULT_SERIAL_DEVICE_NAME "/dev/ttyUSB0"
@@ -286,6 +320,14 @@ static inline void serialDeviceClose(SerialDeviceHandle deviceHandle) {
 #endif
 }
 
+// closes the device even when NO_CLOSE is defined, the next open creates a new handle
+static inline void serialDeviceDrop(SerialDeviceHandle deviceHandle) {
+#ifdef NO_CLOSE
+    serH = INVALID_HANDLE;
+#endif
+    close(deviceHandle);
+}
+
 static inline int serialDeviceWrite(SerialDeviceHandle deviceHandle, char* buffer, int bytesToWrite) {
     return write(deviceHandle, buffer, bytesToWrite);
 }
@@ -293,6 +335,63 @@ static inline int serialDeviceWrite(SerialDeviceHandle deviceHandle, char* buffe
 static inline int serialDeviceRead(SerialDeviceHandle deviceHandle, char* buffer, int bytesToRead) {
     return read(deviceHandle, buffer, bytesToRead);
 }
+
+// waits until data can be read, returns 1 when data are available, 0 on timeout, -1 on error
+static inline int serialDeviceWait(SerialDeviceHandle deviceHandle, int timeoutMs) {
+    struct pollfd p;
+    int result;
+
+    p.fd = deviceHandle;
+    p.events = POLLIN;
+    p.revents = 0;
+    result = poll(&p, 1, timeoutMs);
+    if (result < 0) {
+        return (errno == EINTR) ? 0 : -1;
+    }
+    return (result > 0 && (p.revents & POLLIN)) ? 1 : (result > 0 ? -1 : 0);
+}
+
+#ifndef _OSX_
+// converts the speed to termios constant, returns B0 if the speed is not supported
+static speed_t serialDeviceSpeedConst(int speed) {
+    switch (speed) {
+        case 57600: return B57600;
+        case 115200: return B115200;
+#ifdef B500000
+        case 500000: return B500000;
+#endif
+#ifdef B1000000
+        case 1000000: return B1000000;
+#endif
+#ifdef B2000000
+        case 2000000: return B2000000;
+#endif
+    }
+    return B0;
+}
+#endif
+
+// returns 0 on success
+static inline int serialDeviceSetSpeed(SerialDeviceHandle deviceHandle, int speed) {
+#ifdef _OSX_
+    // OSX supports arbitrary speeds, but only via ioctl
+    speed_t s = speed;
+
+    tcdrain(deviceHandle);
+    return ioctl(deviceHandle, IOSSIOSPEED, &s) == 0 ? 0 : -1;
+#else
+    struct termios serial;
+    speed_t s = serialDeviceSpeedConst(speed);
+
+    if (s == B0 || 0 != tcgetattr(deviceHandle, &serial)) {
+        return -1;
+    }
+    tcdrain(deviceHandle);
+    cfsetispeed(&serial, s);
+    cfsetospeed(&serial, s);
+    return tcsetattr(deviceHandle, TCSANOW, &serial) == 0 ? 0 : -1;
+#endif
+}
 #endif
 
 #endif /* _SERIAL_PORT_H_ */